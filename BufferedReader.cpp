@@ -0,0 +1,133 @@
+//-------------------------------------------------
+// A buffered reader and tokenizer for SPIFFS files
+//-------------------------------------------------
+
+#include "BufferedReader.h"
+
+#include <string.h>
+
+
+bool BufferedReader::fill()
+{
+    m_base += m_len;
+    int got = m_file.read(m_buf,BUFFERED_READER_SIZE);
+    m_pos = 0;
+    m_len = got > 0 ? got : 0;
+    return m_len > 0;
+}
+
+
+int BufferedReader::readToken(char *buf, int max, const char *delims, int *delim /*=nullptr*/)
+{
+    int len = 0;
+    int c = -1;
+    bool any = false;
+
+    while (true)
+    {
+        if (m_pos >= m_len && !fill())
+        {
+            c = -1;
+            break;
+        }
+
+        // scan the buffered block for the next delimiter
+
+        const uint8_t *start = &m_buf[m_pos];
+        const uint8_t *p = start;
+        const uint8_t *end = &m_buf[m_len];
+        while (p < end && !strchr(delims,*p))
+            p++;
+
+        int n = p - start;
+        any = true;
+        if (len + n > max)
+            n = len < max ? max - len : 0;
+        memcpy(&buf[len],start,n);
+        len += n;
+
+        m_pos = p - m_buf;
+        if (p < end)
+        {
+            c = *p;
+            m_pos++;
+            break;
+        }
+    }
+
+    buf[len] = 0;
+    if (delim)
+        *delim = c;
+    return (c < 0 && !any) ? -1 : len;
+}
+
+
+bool BufferedReader::readFloat(float *value, const char *delims)
+{
+    #define MAX_FLOAT  12
+    char buf[MAX_FLOAT+1];
+    int delim;
+    int len = readToken(buf,MAX_FLOAT,delims,&delim);
+    if (delim < 0)
+        return false;
+
+    // leading spaces are allowed, like atof()
+
+    const char *p = buf;
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+        p++;
+
+    *value = 0;
+    parseFloat(p,buf+len,value);
+    return true;
+}
+
+
+const char *parseFloat(const char *first, const char *last, float *value)
+{
+    const char *p = first;
+    bool neg = false;
+    if (p < last && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+
+    double v = 0;
+    int digits = 0;
+    while (p < last && *p >= '0' && *p <= '9')
+    {
+        v = v * 10 + (*p++ - '0');
+        digits++;
+    }
+    if (p < last && *p == '.')
+    {
+        p++;
+        double scale = 0.1;
+        while (p < last && *p >= '0' && *p <= '9')
+        {
+            v += (*p++ - '0') * scale;
+            scale *= 0.1;
+            digits++;
+        }
+    }
+    if (!digits)
+        return first;
+
+    if (p < last && (*p == 'e' || *p == 'E'))
+    {
+        const char *e = p + 1;
+        bool eneg = false;
+        if (e < last && (*e == '-' || *e == '+'))
+            eneg = *e++ == '-';
+        if (e < last && *e >= '0' && *e <= '9')
+        {
+            int exp = 0;
+            while (e < last && *e >= '0' && *e <= '9')
+                exp = exp * 10 + (*e++ - '0');
+            while (exp--)
+                v = eneg ? v / 10 : v * 10;
+            p = e;
+        }
+    }
+
+    *value = neg ? -v : v;
+    return p;
+}
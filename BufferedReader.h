@@ -0,0 +1,65 @@
+//-------------------------------------------------
+// A buffered reader and tokenizer for SPIFFS files
+//-------------------------------------------------
+// File::read() of a single byte goes all the way through the VFS
+// layer on every call.  This reads the file in blocks into a fixed
+// buffer and hands out characters, delimited tokens, and lines from
+// it.  Used by the mesh text file and the yaml overrides loaders.
+
+#pragma once
+
+#include <FS.h>
+
+#define BUFFERED_READER_SIZE   256
+
+
+class BufferedReader
+{
+    public:
+
+        BufferedReader(File &file) :
+            m_file(file),
+            m_len(0),
+            m_pos(0),
+            m_base(0) {}
+
+        int read()
+            // the next character, or -1 at the end of the file
+        {
+            if (m_pos >= m_len && !fill())
+                return -1;
+            return m_buf[m_pos++];
+        }
+
+        int readToken(char *buf, int max, const char *delims, int *delim=nullptr);
+            // Read up to (and consume) the next character in delims,
+            // returning the number of characters placed in buf, which
+            // is always terminated. Characters past max are skipped.
+            // The delimiter found, or -1 at the end of the file, is
+            // returned in delim.  Returns -1 at the end of the file
+            // if nothing was read.
+
+        bool readFloat(float *value, const char *delims);
+            // read a delimited token and parse it as a float.
+            // false at the end of the file (as was the case in
+            // the original readFloat(), even if there was a token).
+
+        uint32_t position()     { return m_base + m_pos; }
+            // the number of bytes consumed so far
+
+    private:
+
+        File    &m_file;
+        uint8_t m_buf[BUFFERED_READER_SIZE];
+        int     m_len;
+        int     m_pos;
+        uint32_t m_base;        // file offset of m_buf[0]
+
+        bool fill();
+};
+
+
+extern const char *parseFloat(const char *first, const char *last, float *value);
+    // std::from_chars() style parse of [sign]digits[.digits][e[sign]digits]
+    // from first up to last, with no locale or allocation. Returns the pointer
+    // after the number, or first (with value unchanged) if there isn't one.
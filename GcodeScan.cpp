@@ -0,0 +1,333 @@
+//-------------------------------------------------
+// A G-code pre-scanner for job time estimates
+//-------------------------------------------------
+
+#include "GcodeScan.h"
+#include "BufferedReader.h"     // parseFloat()
+
+#include <math.h>
+#include <string.h>
+#include <ctype.h>
+
+
+GcodeScan g_gcode_scan;
+
+
+void GcodeScan::begin(uint32_t file_size, float rapid_rate, float accel)
+{
+    m_state = SCAN_NONE;
+    m_num_points = 0;
+
+    m_file_size = file_size;
+    m_rapid_rate = rapid_rate / 60.0;
+    m_accel = accel;
+
+    memset(m_pos,0,sizeof(m_pos));
+    m_absolute = true;
+    m_units = 1.0;
+    m_feed = 0;
+    m_motion = 0;
+
+    m_pending = false;
+    m_time = 0;
+    m_total_time = 0;
+    m_lines = 0;
+    m_scanned = 0;
+
+    m_stride = file_size / (GCODE_SCAN_POINTS - 1);
+    if (!m_stride)
+        m_stride = 1;
+    m_next_mark = m_stride;
+
+    if (file_size)
+        m_state = SCAN_BUSY;
+}
+
+
+void GcodeScan::addPoint(uint32_t offset)
+{
+    int n = m_num_points;
+    if (n >= GCODE_SCAN_POINTS)
+        return;
+    m_offsets[n] = offset;
+    m_times[n] = m_time;
+    m_num_points = n + 1;
+}
+
+
+void GcodeScan::end()
+{
+    if (m_state != SCAN_BUSY)
+        return;
+    finishPending(0);
+    m_total_time = m_time;
+    addPoint(m_scanned);
+    m_state = SCAN_DONE;
+}
+
+
+float GcodeScan::timeAt(uint32_t offset)
+{
+    int n = m_num_points;
+    if (!n || offset > m_offsets[n-1])
+        return m_state == SCAN_DONE ? m_total_time : -1;
+
+    int lo = 0;
+    int hi = n - 1;
+    while (lo < hi)     // first point at or past the offset
+    {
+        int mid = (lo + hi) / 2;
+        if (m_offsets[mid] < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    uint32_t off0 = lo ? m_offsets[lo-1] : 0;
+    float time0 = lo ? m_times[lo-1] : 0;
+    uint32_t span = m_offsets[lo] - off0;
+    if (!span)
+        return m_times[lo];
+    return time0 + (m_times[lo] - time0) * (offset - off0) / span;
+}
+
+
+//-------------------------------------------------
+// timing model
+//-------------------------------------------------
+// Each move accelerates from its entry speed towards its rate and
+// decelerates to its exit speed at m_accel.  The speed at the junction
+// of two moves is the slower of their rates, scaled by the cosine of
+// the angle between them, so a straight line continues at speed and
+// a right angle (or reversal) stops.
+
+void GcodeScan::finishPending(float exit)
+{
+    if (!m_pending)
+        return;
+    m_pending = false;
+
+    float len = m_pending_len;
+    float rate = m_pending_rate;
+    if (m_accel <= 0)
+    {
+        m_time += len / rate;
+        return;
+    }
+
+    float entry = m_pending_entry;
+    float reachable = sqrtf(entry * entry + 2 * m_accel * len);
+    if (exit > reachable)
+        exit = reachable;
+
+    float accel_len = (rate * rate - entry * entry) / (2 * m_accel);
+    float decel_len = (rate * rate - exit * exit) / (2 * m_accel);
+    if (accel_len + decel_len <= len)
+    {
+        m_time += (rate - entry) / m_accel
+                + (rate - exit) / m_accel
+                + (len - accel_len - decel_len) / rate;
+    }
+    else    // never reaches the rate
+    {
+        float peak = sqrtf((2 * m_accel * len + entry * entry + exit * exit) / 2);
+        m_time += (peak - entry) / m_accel + (peak - exit) / m_accel;
+    }
+}
+
+
+void GcodeScan::addMove(const float *to, float len, float rate)
+{
+    float dir[3];
+    float chord = 0;
+    for (int i=0; i<3; i++)
+    {
+        dir[i] = to[i] - m_pos[i];
+        chord += dir[i] * dir[i];
+    }
+    chord = sqrtf(chord);
+    for (int i=0; i<3; i++)
+    {
+        dir[i] = chord > 0 ? dir[i] / chord : 0;
+        m_pos[i] = to[i];
+    }
+
+    if (len <= 0 || rate <= 0)
+        return;
+
+    float junction = 0;
+    if (m_pending)
+    {
+        float cos = 0;
+        for (int i=0; i<3; i++)
+            cos += dir[i] * m_pending_dir[i];
+        if (cos > 0)
+            junction = (rate < m_pending_rate ? rate : m_pending_rate) * cos;
+    }
+    finishPending(junction);
+
+    m_pending = true;
+    m_pending_len = len;
+    m_pending_rate = rate;
+    m_pending_entry = junction;
+    memcpy(m_pending_dir,dir,sizeof(dir));
+}
+
+
+//-------------------------------------------------
+// parser
+//-------------------------------------------------
+
+void GcodeScan::scanLine(const char *line, uint32_t offset)
+{
+    if (m_state != SCAN_BUSY)
+        return;
+    m_lines++;
+    m_scanned = offset;
+
+    float words[26];
+    uint32_t have = 0;      // bit per letter
+    bool dwell = false;
+    bool set_position = false;
+
+    const char *p = line;
+    const char *end = line + strlen(line);
+    while (p < end)
+    {
+        char c = toupper(*p);
+        if (c == ';')
+            break;
+        if (c == '(')
+        {
+            while (p < end && *p != ')')
+                p++;
+            p++;
+            continue;
+        }
+        if (c < 'A' || c > 'Z')
+        {
+            p++;
+            continue;
+        }
+
+        float value;
+        const char *next = parseFloat(p+1,end,&value);
+        if (next == p+1)
+        {
+            p++;
+            continue;
+        }
+        p = next;
+
+        if (c != 'G')
+        {
+            words[c - 'A'] = value;
+            have |= 1 << (c - 'A');
+            continue;
+        }
+
+        switch ((int) (value * 10 + 0.5))
+        {
+            case 0   : m_motion = 0; break;
+            case 10  : m_motion = 1; break;
+            case 20  : m_motion = 2; break;
+            case 30  : m_motion = 3; break;
+            case 40  : dwell = true; break;
+            case 200 : m_units = 25.4; break;
+            case 210 : m_units = 1.0; break;
+            case 900 : m_absolute = true; break;
+            case 910 : m_absolute = false; break;
+            case 920 : set_position = true; break;
+            case 382 :
+            case 383 :
+            case 384 :
+            case 385 : m_motion = 1; break;     // probes move at the feed rate
+        }
+    }
+
+    #define HAVE(c)   (have & (1 << ((c) - 'A')))
+    #define WORD(c)   (words[(c) - 'A'] * m_units)
+
+    if (HAVE('F'))
+        m_feed = WORD('F') / 60.0;
+
+    if (dwell)
+    {
+        finishPending(0);
+        if (HAVE('P'))
+            m_time += words['P' - 'A'];
+    }
+
+    float to[3];
+    bool any = false;
+    for (int i=0; i<3; i++)
+    {
+        char axis = 'X' + i;
+        to[i] = m_pos[i];
+        if (HAVE(axis))
+        {
+            any = true;
+            to[i] = WORD(axis) + (m_absolute || set_position ? 0 : m_pos[i]);
+        }
+    }
+
+    if (set_position)
+        memcpy(m_pos,to,sizeof(to));
+    else if (any)
+    {
+        float rate = m_motion && m_feed > 0 ? m_feed : m_rapid_rate;
+        float len = 0;
+        if (m_motion < 2)
+        {
+            for (int i=0; i<3; i++)
+                len += (to[i] - m_pos[i]) * (to[i] - m_pos[i]);
+            len = sqrtf(len);
+        }
+        else    // arcs in the XY plane
+        {
+            float dx = to[0] - m_pos[0];
+            float dy = to[1] - m_pos[1];
+            float dz = to[2] - m_pos[2];
+            float radius;
+            float sweep;
+            if (HAVE('R'))
+            {
+                radius = fabsf(WORD('R'));
+                float half = sqrtf(dx * dx + dy * dy) / (2 * radius);
+                sweep = 2 * asinf(half < 1 ? half : 1);
+                if (WORD('R') < 0)
+                    sweep = 2 * M_PI - sweep;
+            }
+            else
+            {
+                float i = HAVE('I') ? WORD('I') : 0;
+                float j = HAVE('J') ? WORD('J') : 0;
+                radius = sqrtf(i * i + j * j);
+                // the angle between the radius vectors to the start and
+                // end, as grbl does, so a full circle does not come out 0
+
+                float cross = -i * (dy - j) + j * (dx - i);
+                float dot = -i * (dx - i) - j * (dy - j);
+                sweep = atan2f(cross,dot);
+                if (m_motion == 2 && sweep >= -1e-6)
+                    sweep -= 2 * M_PI;
+                else if (m_motion == 3 && sweep <= 1e-6)
+                    sweep += 2 * M_PI;
+                sweep = fabsf(sweep);
+            }
+            float arc = radius * sweep;
+            len = sqrtf(arc * arc + dz * dz);
+        }
+        addMove(to,len,rate);
+    }
+
+    #undef HAVE
+    #undef WORD
+
+    if (offset >= m_next_mark)
+    {
+        addPoint(offset);
+        while (m_next_mark <= offset)
+            m_next_mark += m_stride;
+    }
+}
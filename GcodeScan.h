@@ -0,0 +1,100 @@
+//-------------------------------------------------
+// A G-code pre-scanner for job time estimates
+//-------------------------------------------------
+// The byte percentage of an SD job says little about the time left
+// when a file has dense and sparse sections.  GcodeScan is fed the
+// lines of a job, ahead of it being run, and estimates how long each
+// move takes from its length, feed rate, and a simple acceleration and
+// junction speed model.  It keeps a table of the estimated time at
+// regular byte offsets, so the time based progress can be looked up
+// from the byte position of the running job.
+//
+// It is plain C++ so that it can be built and benchmarked on Linux
+// (see extras/gcode_scan).  On the ESP32 gActions::startSDJob() runs
+// it in a low priority task and gStatus reports the results.
+
+#pragma once
+
+#include <stdint.h>
+
+#define GCODE_SCAN_POINTS   256     // progress table entries
+#define GCODE_SCAN_LINE     96      // longest line parsed, the rest is ignored
+
+
+class GcodeScan
+{
+    public:
+
+        GcodeScan()     { begin(0,0,0); }
+
+        void begin(uint32_t file_size, float rapid_rate, float accel);
+            // start a new scan, with the rapid rate in mm/min
+            // and the acceleration in mm/s^2
+        void scanLine(const char *line, uint32_t offset);
+            // scan one line, offset is the byte offset after it
+        void end();
+            // the end of the file was reached
+        void abort()            { m_state = SCAN_NONE; }
+
+        bool scanning()         { return m_state == SCAN_BUSY; }
+        bool done()             { return m_state == SCAN_DONE; }
+
+        uint32_t fileSize()     { return m_file_size; }
+        uint32_t lines()        { return m_lines; }
+        uint32_t scanned()      { return m_scanned; }
+            // bytes scanned so far
+        float totalTime()       { return m_total_time; }
+            // estimated seconds for the whole file, once done()
+        float timeAt(uint32_t offset);
+            // estimated seconds to run upto the byte offset,
+            // or -1 if the scan has not got that far
+
+    private:
+
+        enum { SCAN_NONE, SCAN_BUSY, SCAN_DONE };
+
+        volatile int m_state;
+
+        uint32_t m_file_size;
+        float m_rapid_rate;         // mm/s
+        float m_accel;              // mm/s^2
+
+        // modal state
+
+        float m_pos[3];
+        bool  m_absolute;
+        float m_units;              // 1 or 25.4
+        float m_feed;               // mm/s
+        int   m_motion;             // 0..3
+
+        // the previous move, which is not timed until the
+        // next one gives its exit (junction) speed
+
+        bool  m_pending;
+        float m_pending_len;
+        float m_pending_rate;
+        float m_pending_entry;
+        float m_pending_dir[3];
+
+        float m_time;               // seconds, of the timed moves
+        float m_total_time;
+        uint32_t m_lines;
+        uint32_t m_scanned;
+
+        // the progress table, append only, so that it can be read
+        // by another task while it is being built
+
+        uint32_t m_stride;
+        uint32_t m_next_mark;
+        uint32_t m_offsets[GCODE_SCAN_POINTS];
+        float m_times[GCODE_SCAN_POINTS];
+        volatile int m_num_points;
+
+        void addMove(const float *to, float len, float rate);
+        void finishPending(float exit);
+        void addPoint(uint32_t offset);
+};
+
+
+extern GcodeScan g_gcode_scan;
+    // the scan of the current SD job
@@ -1,1079 +1,1848 @@
-//-------------------------------------------------
-// Mesh bed levelling
-//-------------------------------------------------
-// 1. the mesh starts at whatever MESH_X,MESH_Y (mpos floats)
-//    the machine happens to be at when the $HZ happens
-// 2. uess WIDTH and HEIGHT in mm and STEPS_X and STEPS_Y integers
-// 3. the MESH, and it's 6 parameters are written to a SPIFFS text file
-// 4. readMesh() is from cnc3018.ino() setup after grbl_init() finishes.
-//
-//   If the WIDTH, HEIGHT, STEPS_X, or STEPS_Y have changed the mesh is
-//   invalidated in readMesh().  The MESH_X and MESH_Y are not user params.
-//
-//   The other user params Z_PULLOFF, Z_MAX_TRAVEL, Z_FEED_RATE, and
-//   LINE_SEG_LENGTH can change without invalidating the mesh.
-//
-//   thus readMesh() is also called from group() when one of the given
-//   items is changing at runtime.
-
-// my test zero is at x=62 y=9
-
-#include "Mesh.h"
-#include "FluidDebug.h"
-
-#include <GCode.h>                              // FluidNC
-#include <MotionControl.h>                      // FluidNC
-#include <Protocol.h>                           // FluidNC
-#include <Report.h>                             // FluidNC
-#include <Serial.h>                             // FluidNC
-#include <System.h>                             // FluidNC
-#include <Uart.h>                               // FluidNC
-#include <Configuration/RuntimeSetting.h>       // FluidNC
-#include <Planner.h>
-#include <Machine/MachineConfig.h>              // FluidNC
-
-#include <gStatus.h>							// FluidNC_extensions
-
-#include <SPIFFS.h>
-#include <FS.h>
-
-#ifndef USE_LARGE_MESH
-	// This file, Mesh.cpp, contains the only usage of this define.
-	// The _vMachine does not use the mesh.
-	// Otherwise, all it does it define bigger default constants for
-	// the larger cnc20mm.
-	#define USE_LARGE_MESH  0
-#endif
-
-#if USE_LARGE_MESH
-	#pragma message "Using Larger (cnc20mm) mesh constants"
-#else
-	#pragma message "Using Smaller (cnc3018) mesh constants"
-#endif
-
-
-
-#define DEBUG_MESH          1       // upto 3
-#define DEBUG_GET_Z_OFFSET  0
-#define DEBUG_VREVERSE      0       // upto 2
-#define DEBUG_VFORWARD      0
-
-
-#define Z_AXIS       2
-#define Z_AXIS_MASK  0x04
-#define Y_AXIS_MASK  0x02
-
-#if USE_LARGE_MESH
-	#define DEFAULT_MESH_HEIGHT         1100      // mm
-	#define DEFAULT_MESH_WIDTH          1100      // mm
-	#define DEFAULT_MESH_X_STEPS        9         // every 25mm
-	#define DEFAULT_MESH_Y_STEPS        9         // every 20mm
-	#define DEFAULT_MESH_Z_PULLOFF      6.0       // pull off after 0th point
-	#define DEFAULT_MESH_Z_MAX_TRAVEL   -50.0     // mm in negative direction from absolute 0,0
-	#define DEFAULT_MESH_Z_FEED_RATE    80.0      // mm per min
-	#define DEFAULT_MESH_XY_SEEK_RATE   4000.00
-	#define DEFAULT_LINE_SEG_LENGTH     10        // mm
-	#define DEFAULT_NUM_PROBES          1         // count
-#else
-	#define DEFAULT_MESH_HEIGHT         80        // mm
-	#define DEFAULT_MESH_WIDTH          125       // mm
-	#define DEFAULT_MESH_X_STEPS        6         // every 25mm
-	#define DEFAULT_MESH_Y_STEPS        4         // every 20mm
-	#define DEFAULT_MESH_Z_PULLOFF      2.0       // pull off after 0th point
-	#define DEFAULT_MESH_Z_MAX_TRAVEL   -35.0     // mm in negative direction from absolute 0,0
-	#define DEFAULT_MESH_Z_FEED_RATE    20.0      // mm per min
-	#define DEFAULT_MESH_XY_SEEK_RATE   800.00
-	#define DEFAULT_LINE_SEG_LENGTH     2         // mm
-	#define DEFAULT_NUM_PROBES          1         // count
-#endif
-
-
-
-#define MESH_DATA_FILE  "/mesh_data.txt"
-
-
-
-Mesh::Mesh()
-{
-    m_is_valid = 0;
-    m_in_leveling = 0;
-	m_cur_step = 0;
-
-	m_live_z = 0;
-    m_last_mesh_z = 0;
-
-	_height			    = DEFAULT_MESH_HEIGHT;
-	_width			    = DEFAULT_MESH_WIDTH;
-	_x_steps		    = DEFAULT_MESH_X_STEPS;
-	_y_steps		    = DEFAULT_MESH_Y_STEPS;
-	_z_pulloff		    = DEFAULT_MESH_Z_PULLOFF;
-	_z_max_travel	    = DEFAULT_MESH_Z_MAX_TRAVEL;
-	_z_feed_rate	    = DEFAULT_MESH_Z_FEED_RATE;
-	_xy_seek_rate       = DEFAULT_MESH_XY_SEEK_RATE;
-    _line_seg_length    = DEFAULT_LINE_SEG_LENGTH;
-}
-
-
-void Mesh::group(Configuration::HandlerBase& handler) // override
-{
-	handler.item("height", 	    _height);
-	handler.item("width", 		_width);
-	handler.item("x_steps",	    _x_steps);
-	handler.item("y_steps",     _y_steps);
-	handler.item("pulloff",     _z_pulloff);
-	handler.item("max_travel",  _z_max_travel);
-	handler.item("feed_rate",   _z_feed_rate);
-	handler.item("xy_seek_rate",_xy_seek_rate);
-    handler.item("line_seg_len",_line_seg_length);
-	handler.item("num_probes",   m_num_probes);
-
-	if (m_num_probes > 4)
-		m_num_probes = 4;
-	if (m_num_probes < 1)
-		m_num_probes = 1;
-
-	if (_x_steps > MAX_MESH_X_STEPS)
-		_x_steps = MAX_MESH_X_STEPS;
-	if (_y_steps > MAX_MESH_Y_STEPS)
-		_y_steps = MAX_MESH_Y_STEPS;
-
-
-	// possibly invalidate the mesh upon certain changes
-
-    if (m_is_valid && handler.handlerType() == Configuration::HandlerType::Runtime)
-    {
-        Configuration::RuntimeSetting &rth = static_cast<Configuration::RuntimeSetting &>(handler);
-        if (rth.is("height") ||
-            rth.is("width") ||
-            rth.is("x_steps") ||
-            rth.is("y_steps"))
-        {
-            #if DEBUG_MESH
-                g_debug("Mesh::group() calling readMesh() for validation");
-            #endif
-            readMesh();
-        }
-    }
-
-
-	// MESH COMMANDS
-	// a weird way to add $commands
-
-	if (handler.handlerType() == Configuration::HandlerType::Runtime)
-	{
-		Configuration::RuntimeSetting &rth = static_cast<Configuration::RuntimeSetting &>(handler);
-		if (rth.is("show"))
-		{
-			debug_mesh();
-			rth.isHandled_ = true;
-		}
-		else if (rth.is("clear"))
-		{
-			invalidateMesh();
-			rth.isHandled_ = true;
-			//int command_result = 237;
-			//handler.item("blah", command_result);
-		}
-		else if (rth.is("do_level"))
-		{
-			doMeshLeveling();
-			rth.isHandled_ = true;
-		}
-	}
-
-}
-
-
-
-//--------------------------------------------
-// retrieval API
-//--------------------------------------------
-
-
-float Mesh::getZOffset(float mx, float my)
-    // IN WORK COORDINATES
-{
-    if (!m_is_valid)
-    {
-        return 0.00;
-    }
-
-    #if DEBUG_GET_Z_OFFSET
-        g_debug("GET_Z_OFFSET(%5.3f,%5.3f) meshxy(%5.3f,%5.3f)",mx,my,m_mesh_x,m_mesh_y);
-    #endif
-
-    // make mx and my mesh relative
-
-    mx -= m_mesh_x;
-    my -= m_mesh_y;
-
-    #if DEBUG_GET_Z_OFFSET
-        g_debug("   mesh_relxy((%5.3f,%5.3f)",mx,my);
-    #endif
-
-    // develop the integer "box" coordinates
-    // into the mesh array along the percentage
-    // traversed into the box
-
-    int x_left;
-    int x_right;
-    float pct_x;
-    if (mx < 0)
-    {
-        x_left = 0;
-        x_right = 0;
-        pct_x = 1.0;
-    }
-    else
-    {
-        x_left = mx / m_dx;
-        x_right = x_left + 1;
-        if (x_left > _x_steps - 1)
-            x_left = _x_steps - 1;
-        if (x_right > _x_steps - 1)
-            x_right = _x_steps - 1;
-        pct_x = (mx - x_left * m_dx) / m_dx;
-        if (pct_x > 1.0) pct_x = 1.0;
-    }
-
-    int y_top;
-    int y_bottom;
-    float pct_y;
-    if (my < 0)
-    {
-        y_top = 0;
-        y_bottom = 0;
-        pct_y = 1.0;
-    }
-    else
-    {
-        y_bottom = my / m_dy;
-        y_top = y_bottom + 1;
-        if (y_bottom > _y_steps - 1)
-            y_bottom = _y_steps - 1;
-        if (y_top > _y_steps - 1)
-            y_top = _y_steps - 1;
-        pct_y = (my - y_bottom * m_dy) / m_dy;
-    }
-
-    // get the four values
-
-    float left_bottom =    m_mesh[y_bottom * MAX_MESH_X_STEPS + x_left];	// old: [x_left][y_bottom];
-    float left_top =       m_mesh[y_top    * MAX_MESH_X_STEPS + x_left];    // old: [x_left][y_top];
-    float right_bottom =   m_mesh[y_bottom * MAX_MESH_X_STEPS + x_right];   // old: [x_right][y_bottom];
-    float right_top =      m_mesh[y_top    * MAX_MESH_X_STEPS + x_right];   // old: [x_right][y_top];
-
-    // calculate the contribution
-    //
-    //    lt               rt
-    //
-    //
-    //            o  pct_x,pct_y
-    //
-    //
-    //     lb               rb
-
-    float left = left_bottom + pct_y * (left_top - left_bottom);
-    float right = right_bottom + pct_y * (right_top - right_bottom);
-    float value = left + pct_x * (right - left);
-
-    #if DEBUG_GET_Z_OFFSET
-        g_debug("   zone_lrtb(%d,%d,%d,%d)  pct_x=%5.3f  pct_y=%5.3f",
-            x_left,
-            x_right,
-            y_top,
-            y_bottom,
-            pct_x,
-            pct_y);
-
-        g_debug("   mesh lb(%5.3f) lt(%5.3f) rb(%5.3f) rt(%5.3f)",
-            left_bottom,
-            left_top,
-            right_bottom,
-            right_top);
-
-        g_debug("   left(%5.3f)  right(%5.3f)  FINAL VALUE(%5.3f)",
-            left,
-            right,
-            value);
-    #endif
-
-    return value;
-
-}
-
-
-
-//--------------------------------------------
-// generation API
-//--------------------------------------------
-
-
-void Mesh::debug_mesh()
-{
-	g_info("MESH: position=(%0.3f,%0.3f,%0.3f)",m_mesh_x,m_mesh_y,m_zero_point);
-	for (int y=_y_steps-1; y>=0; y--)
-	{
-		static char buf[180];
-		sprintf(buf,"MESH[%d] ",y);
-		for (int x=0; x<_x_steps; x++)
-		{
-			sprintf(&buf[strlen(buf)]," % 6.3f",m_mesh[y * MAX_MESH_X_STEPS + x]);
-		}
-		g_info(buf);
-	}
-}
-
-
-void Mesh::init_mesh()
-{
-    #if DEBUG_MESH > 2
-        g_debug("MESH: init_mesh()");
-    #endif
-
-    m_mesh_x = 0.0;
-    m_mesh_y = 0.0;
-
-    m_zero_point = 0.0;
-    m_is_valid = false;
-
-    m_dx = _width / (_x_steps-1);
-    m_dy = _height / (_y_steps-1);
-
-	for (int y=0; y<MAX_MESH_Y_STEPS; y++)
-	{
-		for (int x=0; x<MAX_MESH_X_STEPS; x++)
-		{
-            m_mesh[y * MAX_MESH_X_STEPS + x] = 0.00;
-        }
-    }
-}
-
-
-
-static bool _mesh_execute(char *buf)
-    // _ means it does not use any member variables
-{
-    #if DEBUG_MESH > 2
-        g_debug("MESH: _mesh_execute(%s)",buf);
-    #endif
-
-    Error rslt = gc_execute_line(buf, Uart0);
-    if (rslt != Error::Ok)
-    {
-        report_status_message(rslt, allClients);
-        g_error("MESH: gc_execute_line(%s) failed",buf);
-        return false;
-    }
-    protocol_buffer_synchronize();
-    if (sys.abort)
-    {
-        g_error("MESH: move aborted");
-        return false;           // Bail to main() program loop to reset system.
-    }
-    #if DEBUG_MESH > 2
-        g_debug("MESH: move completed");
-    #endif
-    return true;
-}
-
-
-bool Mesh::moveTo(float x, float y)
-    // move in current coordinate system
-    // _ means it does not use any member variables
-{
-    #if DEBUG_MESH > 2
-        g_debug("MESH: _moveTo(%5.3f,%5.3f)",x,y);
-    #endif
-    char buf[80];
-    sprintf(buf,"g1 g53 x%5.3f y%5.3f f%5.3f",x,y,_xy_seek_rate);
-    return _mesh_execute(buf);
-}
-
-
-bool Mesh::zPullOff(float from) // move z upwards relative, check that probe goes off too
-{
-    // float to = m_zero_point + _z_pulloff;
-
-    float to = from + _z_pulloff;
-
-    #if DEBUG_MESH > 2
-        g_debug("MESH: zPullOff() from=%5.3f to=%5.3f",from,to);
-    #endif
-
-    char buf[80];
-    sprintf(buf,"g1 g53 z%5.3f f%5.3f",to,_xy_seek_rate);	// old: g_status.getAxisFeedRate(Z_AXIS));
-		// 	We use the xy_rate for the pulloff
-
-    bool move_ok = _mesh_execute(buf);
-    if (move_ok)
-    {
-        if (config->_probe->tripped())
-        {
-            g_error("MESH: zPullOff() failed!");
-            rtAlarm = ExecAlarm::HomingFailPulloff;
-            return false;
-        }
-    }
-    return true;
-}
-
-
-
-
-bool Mesh::probeOne(int x, int y, float *zResult)
-    // do a probe and return the z value in absolute machine coordinates
-{
-    #if DEBUG_MESH > 2
-        g_debug("MESH: probeOne()");
-    #endif
-
-    char buf[60];
-    sprintf(buf,"g38.2 z%5.3f f%5.3f",
-        _z_max_travel,
-        _z_feed_rate);
-
-    #if DEBUG_MESH > 2
-        g_debug("MESH: probeOne() execute(%s)",buf);
-    #endif
-
-    // do upto N probes with heuristics to throw out bad values
-
-
-    bool ok = true;
-    int probe_num = 0;
-	int i_num_probes = m_num_probes;
-    float probe_values[i_num_probes];
-
-    while (ok && probe_num < m_num_probes)
-    {
-		protocol_execute_realtime();
-		if (sys.abort)
-			return false;
-
-        float value = 0;
-        Error rslt = gc_execute_line(buf, Uart0);
-        if (rslt == Error::Ok)
-        {
-            value = steps_to_mpos(probe_steps[Z_AXIS],Z_AXIS);
-            #if DEBUG_MESH > 1
-                g_debug("MESH[%d,%d] probe[%d]=%f",y,x,probe_num,value);
-            #endif
-            probe_values[probe_num++] = value;
-    }
-        else
-        {
-            ok = false;
-            report_status_message(rslt, allClients);
-            g_error("MESH: probeOne() gc_execute_line failed");
-        }
-
-		protocol_execute_realtime();
-		if (sys.abort)
-			return false;
-
-        if (!zPullOff(value))
-			return false;
-    }
-
-    float value = 0;
-    if (ok)
-    {
-        for (int i=0; i<m_num_probes; i++)
-            value += probe_values[i];
-        value /= ((float)m_num_probes);
-
-        #if DEBUG_MESH > 1
-            g_debug("MESH[%d,%d] average=%f",y,x,value);
-        #endif
-
-		if (m_num_probes >= 3)
-		{
-            // throw out the extreme value
-            int max_idx = -1;
-            float max_delta = -1;
-            for (int i=0; i<m_num_probes; i++)
-            {
-                float delta = abs(value-probe_values[i]);
-                if (delta > max_delta)
-                {
-                    max_idx = i;
-                    max_delta = delta;
-                }
-            }
-
-            #if DEBUG_MESH > 1
-                g_debug("MESH[%d,%d] throwing out %d:%f",y,x,max_idx,probe_values[max_idx]);
-            #endif
-
-            value = 0;
-            for (int i=0; i<m_num_probes; i++)
-            {
-                if (i != max_idx)
-                    value += probe_values[i];
-            }
-            value /= ((float)m_num_probes-1);
-
-            #if DEBUG_MESH
-                g_debug("MESH[%d,%d] FINAL AVERAGE=%f",y,x,value);
-            #endif
-		}
-    }
-
-    *zResult = value;
-    return ok;
-}
-
-
-bool Mesh::doMeshLeveling()
-{
-    m_in_leveling = true;
-	m_cur_step = 0;
-
-    init_mesh();
-
-    // Finish all queued commands and empty planner buffer before starting probe cycle.
-    // Return if system reset has been issued.
-
-    protocol_buffer_synchronize();
-    if (sys.abort)
-    {
-        m_in_leveling = false;
-        return false;
-    }
-
-	sys.state = State::Idle;
-	config->_stepping->beginLowLatency();
-
-    m_mesh_x = steps_to_mpos(motor_steps[X_AXIS],X_AXIS);
-    m_mesh_y = steps_to_mpos(motor_steps[Y_AXIS],Y_AXIS);
-
-    #if DEBUG_MESH
-        g_debug("MESH: doMeshLeveling(%5.3f,%5.3f)",m_mesh_x,m_mesh_y);
-    #endif
-
-    for (int y=0; y<_y_steps; y++)
-    {
-        int start = y & 1 ? _x_steps-1 : 0;
-        int end   = y & 1 ? -1 : _x_steps;
-        int inc   = y & 1 ? -1 : 1;
-
-        for (int x=start; x!=end; x+=inc)
-        {
-			protocol_execute_realtime();
-			if (sys.abort)
-				return false;
-
-            if (moveTo(m_mesh_x + x*m_dx, m_mesh_y + y*m_dy))
-            {
-                float value = 0.0;
-                if (probeOne(x,y,&value))
-                {
-                    if (x==0 && y==0)
-                    {
-                        m_zero_point = value;
-
-                        #if DEBUG_MESH > 1
-                            g_debug("MESH: m_zero_point <= %6.3f",m_zero_point);
-                        #endif
-                    }
-                    else
-                    {
-                        m_mesh[y * MAX_MESH_X_STEPS + x] = value - m_zero_point;
-
-                        #if DEBUG_MESH > 1
-                            g_debug("MESH: m_mesh[%d,%d] <= %6.3f",y,x,m_mesh[y * MAX_MESH_X_STEPS + x]);
-                        #endif
-                    }
-
-                }   // probeOne() succeeded
-                else
-                {
-                    g_error("MESH: probeOne(%d,%d) failed",x,y);
-                    m_in_leveling = false;
-                    return false;
-                }
-            }   // move succeeded
-            else
-            {
-                g_error("MESH: moveTo(%d,%d) failed",x,y);
-                m_in_leveling = false;
-                return false;
-            }
-
-			m_cur_step++;
-
-        }   // for x_steps
-    }   // for y_steps
-
-	config->_stepping->endLowLatency();
-
-	protocol_execute_realtime();
-	if (sys.abort)
-		return false;
-
-	#if DEBUG_MESH
-	    debug_mesh();
-    #endif
-
-	// move to the original (given) x y position and
-	// z_pulloff above the determined position
-
-    char buf[80];
-    sprintf(buf,"g0 g53 x%5.3f y%5.3f z%5.3f",m_mesh_x,m_mesh_y,m_zero_point + _z_pulloff);
-	bool ok = _mesh_execute(buf);
-
-	Stepper::go_idle();         // Set steppers to the settings idle state before returning.
-	sys.state = State::Idle;    // Set to IDLE when complete.
-
-	protocol_execute_realtime();
-	if (sys.abort)
-		return false;
-
-    if (ok && writeMesh())
-    {
-		// set the z-zero position from the mesh pulloff position
-
-		sprintf(buf,"g10 L20 z%5.3f",_z_pulloff);
-		m_is_valid = _mesh_execute(buf);
-    }
-
-    m_in_leveling = false;
-
-	#if DEBUG_MESH
-		g_debug("MESH: doMeshLeveling() %s",m_is_valid?"succeeded!":"failed");
-	#endif
-
-    return m_is_valid;
-}
-
-
-//--------------------------------------------
-// Data File
-//--------------------------------------------
-
-void Mesh::invalidateMesh()
-{
-    #if DEBUG_MESH
-        g_debug("--->invalidateMesh()");
-    #endif
-    m_is_valid = false;
-    SPIFFS.remove(MESH_DATA_FILE);
-}
-
-
-bool readFloat(File f, float *v)
-{
-    #define MAX_FLOAT  12
-    int len = 0;
-    char buf[MAX_FLOAT+5];
-    int c = f.read();
-    while (c >= 0 &&
-           len < MAX_FLOAT &&
-           c != '\n' &&
-           c != ',')
-    {
-        buf[len++] = c;
-        c = f.read();
-    }
-    buf[len] = 0;
-    if (c >= 0)
-    {
-        float val = atof(buf);
-        // g_debug("read float %s=%f",buf,val);
-        *v = val;
-        return true;
-    }
-    return false;
-}
-
-
-void Mesh::readMesh()
-{
-    #if DEBUG_MESH > 1
-        g_debug("readMesh()");
-    #endif
-
-    init_mesh();
-
-    if (SPIFFS.exists(MESH_DATA_FILE))
-    {
-        bool ok = false;
-        File f = SPIFFS.open(MESH_DATA_FILE, "r");
-        if (f)
-        {
-            float header[7];
-            if (readFloat(f,&header[0]) &&
-                readFloat(f,&header[1]) &&
-                readFloat(f,&header[2]) &&
-                readFloat(f,&header[3]) &&
-                readFloat(f,&header[4]) &&
-                readFloat(f,&header[5]) &&
-                readFloat(f,&header[6]))
-            {
-                #if DEBUG_MESH > 1
-                    g_debug("got Mesh Header x,y,w,h,sx,sy,zp: %5.3f,%5.3f,%5.3f,%5.3f,%1.0f,%1.0f,%5.3f",
-                        header[0],
-                        header[1],
-                        header[2],
-                        header[3],
-                        header[4],
-                        header[5],
-                        header[6]);
-                    // g_debug("versus w,h,sx,sy %5.3f,%5.3f,%5.3f,%5.3f",
-                    //     _width,
-                    //     _height,
-                    //     _x_steps,
-                    //     _y_steps);
-                #endif
-
-                if (header[2] == _width &&
-                    header[3] == _height &&
-                    header[4] == _x_steps &&
-                    header[5] == _y_steps)
-                {
-                    #if DEBUG_MESH > 1
-                        g_debug("Mesh Header Valid - reading mesh");
-                    #endif
-
-                    ok = true;
-
-                    m_mesh_x = header[0];
-                    m_mesh_y = header[1];
-                    m_zero_point = header[6];
-
-                    for (int y=0; ok && (y<_y_steps); y++)
-                    {
-                        for (int x=0; ok && (x<_x_steps); x++)
-                        {
-                            if (!readFloat(f,&m_mesh[y * MAX_MESH_X_STEPS + x]))
-                            {
-                                ok = false;
-                                g_error("Could not read mesh value(%d,%d)",y,x);                            }
-                        }
-                    }
-
-                    if (ok)
-                    {
-                        #if DEBUG_MESH
-                            g_debug("readMesh() VALID!!");
-	                        debug_mesh();
-                        #endif
-                        m_is_valid = true;
-                    }
-                }
-                else
-                {
-                    g_debug("Mesh Header INVALID!!");
-                }
-            }
-            else
-            {
-                g_error("Could not read mesh header");
-            }
-
-            f.close();
-
-        }   // file opened
-
-        else
-        {
-            g_error("Could not open %s for reading",MESH_DATA_FILE);
-
-        }
-
-        if (!ok)
-            invalidateMesh();
-
-    }   // file exists
-}
-
-
-
-bool writeFloat(File f, float v, bool newline=true, bool prec_comma=false)
-{
-    char buf[18];
-    sprintf(buf,"%-5.3f",v);
-    if (prec_comma)
-        if (f.print(",") != 1)
-            return false;
-    if (f.print(buf) != strlen(buf))
-        return false;
-    if (newline)
-        if (f.print("\n") != 1)
-            return false;
-    return true;
-}
-
-
-bool Mesh::writeMesh()
-{
-    g_debug("writeMesh()");
-    bool ok = false;
-    File f = SPIFFS.open(MESH_DATA_FILE, "w");
-    if (f)
-    {
-        if (writeFloat(f,m_mesh_x) &&
-            writeFloat(f,m_mesh_y) &&
-            writeFloat(f,_width) &&
-            writeFloat(f,_height) &&
-            writeFloat(f,_x_steps) &&
-            writeFloat(f,_y_steps) &&
-            writeFloat(f,m_zero_point))
-        {
-            ok = true;
-            for (int y=0;ok && (y<_y_steps); y++)
-            {
-                for (int x=0;ok && (x<_x_steps); x++)
-                {
-                    if (!writeFloat(f,m_mesh[y * MAX_MESH_X_STEPS + x],false,x>0))
-                        ok = false;
-                }
-                if (f.print("\n") != 1)
-                    ok = false;
-            }
-        }
-
-        f.close();
-        if (!ok)
-        {
-            g_error("There was a problem writing to %s",MESH_DATA_FILE);
-            invalidateMesh();
-        }
-        return ok;
-    }
-    g_error("WARNING: Could not open %s for writing",MESH_DATA_FILE);
-    invalidateMesh();
-    return false;
-}
-
-
-
-//  #if MESH_USER_DEFINED_HOMING
-//  	bool Mesh::user_defined_homing(AxisMask axisMask)
-//  	{
-//  		// $HZ builds the mesh
-//  		// $HY invalidates the mesh
-//
-//  		if (axisMask == Y_AXIS_MASK)
-//  		{
-//  			g_debug("Mesh::user_defined_homing Y calling invalidateMesh()");
-//  			invalidateMesh();
-//  			return true;
-//  		}
-//
-//  		if (axisMask == Z_AXIS_MASK)
-//  		{
-//  			g_debug("Mesh::user_defined_homing Z calling doMeshLeveling()");
-//  			doMeshLeveling();
-//  			return true;
-//  		}
-//
-//  		return false;
-//  	}
-//  #endif
-
-
-//======================================================================
-// implement "kinematics" to shoehorn the mesh into FluidNC
-//======================================================================
-
-bool Mesh::cartesian_to_motors(float* target, plan_line_data_t* pl_data, float* position)
-    // THE REALTIME Z IS POSITIVE TO MOVE THE HEAD UP and NEGATIVE to move the head DOWN
-    // my cut depth was 0.2 and I ended up setting the realtimeZOffset to 0.15, making
-    // my effective cut depth 0.05 .. and that was still deep, but you have to account
-    // for the tip breaking off of the bit in the first few minutes and becoming dull
-    // over an entire run..
-    //
-    // given a target and initial position in Machine Coordinates
-    // call mc_line() to move to the new position possibly including
-    // the mesh z offset
-{
-    float tpos[6];
-    float new_pos[6];
-    memset(tpos,0,6*sizeof(float));
-    memset(new_pos,0,6*sizeof(float));
-
-	#if DEBUG_VREVERSE
-		g_debug("C2M from(%5.3f,%5.3f,%5.3f) to (%5.3f,%5.3f,%5.3f)",
-			position[X_AXIS],
-            position[Y_AXIS],
-            position[Z_AXIS],
-            target[X_AXIS],
-            target[Y_AXIS],
-            target[Z_AXIS]);
-	#endif
-
-    // if the mesh is not valid, just call a single mc_line()
-    // for the entire traversal
-
-    if (!m_is_valid ||
-        sys.state == State::Homing)
-    {
-        memcpy(new_pos,target,3 * sizeof(float));
-
-		// ADD the live_z to the motor position
-
-		if (sys.state != State::Homing)
-			new_pos[Z_AXIS] += m_live_z;
-
-        if (!mc_line(new_pos, pl_data))
-			return false;
-        return true;
-    }
-
-    memcpy(new_pos,position,3 * sizeof(float));
-
-    // break the x/y portion of the line up into multiple segments
-
-	uint32_t num_segs = 1;
-	float xdist = target[X_AXIS] - new_pos[X_AXIS];
-	float ydist = target[Y_AXIS] - new_pos[Y_AXIS];
-	float zdist = target[Z_AXIS] - new_pos[Z_AXIS];
-
-	if (!pl_data->motion.rapidMotion && (xdist!=0 || ydist!=0))
-	{
-		float dist = sqrt(xdist*xdist + ydist*ydist + zdist*zdist);
-		float f_num_segs = (dist + (_line_seg_length/2))/_line_seg_length;
-		num_segs = f_num_segs;
-		if (!num_segs) num_segs = 1;
-	}
-
-	//--------------------
-	// do loop of segments
-	//--------------------
-
-	float xinc = xdist/num_segs;
-	float yinc = ydist/num_segs;
-    float zinc = zdist/num_segs;
-
-	#if DEBUG_VREVERSE
-		g_debug("C2M doing %d segments with incs(%5.3f,%5.3f,%5.3f)",
-			num_segs,
-			xinc,
-			yinc,
-			zinc);
-	#endif
-
-	for (uint32_t seg_num=0; seg_num<num_segs; seg_num++)
-	{
-		new_pos[X_AXIS] += xinc;
-		new_pos[Y_AXIS] += yinc;
-		new_pos[Z_AXIS] += zinc;
-
-        // we need a working copy of the position
-        // so that we don't accumulate zOffsets
-
-        memcpy(tpos,new_pos,3 * sizeof(float));
-
-		// ADD the live_z to the motor position
-
-		tpos[Z_AXIS] += m_live_z;
-
-        // get the zOffset at the work position
-        // and add it to the working copy
-
-        float zoff = getZOffset(new_pos[X_AXIS],new_pos[Y_AXIS]);
-        tpos[Z_AXIS] += zoff;
-
-        // to see values in Arduino plotter:
-        // Uart0.printf("%5.3f,%5.3f,%5.3f\r\n",realtimeZOffset,position[Z_AXIS]+24.222,zoff);
-
-		#if DEBUG_VREVERSE>1
-			g_debug("C2M seg(%d) to(%5.3f,%5.3f,%5.3f) zoff=%5.3f",
-				seg_num,
-				tpos[X_AXIS],
-				tpos[Y_AXIS],
-				tpos[Z_AXIS],
-				zoff);
-		#endif
-
-		delay(5);	// IMPORTANT: let other tasks run
-
-		// hmmm ... i thought mc_line failing was the problem,
-		// but this code is never executed (I think it was the
-		// dealy that was needed).  And maybe $message/level=DEBUG
-		// helped by emulating that
-
-		int problem_reported = 0;
-		while (!mc_line(tpos, pl_data))
-		{
-			if (sys.abort)
-			{
-				log_error("SYS_ABORT FROM MESH MC_LINE FAIL!!!");
-				return false;
-			}
-			// report the problem once per second
-			// forever with a seconds counter
-			if (problem_reported++ % 100 == 0)
-				log_info("MESH MC_LINE_FAILED " << problem_reported/100);
-			delay(10);
-		}
-
-	}	// for each segment
-
-    return true;
-
-}
-
-
-//--------------------------------------------------------------------------------------------------------
-// motors_to_cartesian
-//--------------------------------------------------------------------------------------------------------
-
-void Mesh::motors_to_cartesian(float* cartesian, float* motors, int n_axis)
-    // the input variable "motors" is "machine position"
-    // the output variable is "cartesian"
-{
-    // the only thing we might change is the Z
-
-    memcpy(cartesian,motors,3 * sizeof(float));
-
-	// SUBTRACT out the live z
-	// if it's negative we added it during cartesian_to_motors()
-
-    cartesian[Z_AXIS] -= m_live_z;
-
-    // if the mesh is not valid, just return the input
-
-    if (!m_is_valid ||
-        sys.state == State::Homing)
-        return;
-
-    // get the zOffset at the location
-    // and subtract it from the z location
-
-    float zoff = m_last_mesh_z = getZOffset(motors[X_AXIS],motors[Y_AXIS]);
-
-    #if DEBUG_VFORWARD
-        g_debug("M2C(%5.3f,%5.3f,%5.3f) subtracting z_offset(%5.3f)",
-            motors[X_AXIS],
-            motors[Y_AXIS],
-            motors[Z_AXIS],
-            zoff);
-    #endif
-
-    cartesian[Z_AXIS] -= zoff;
-}
-
-
-void  Mesh::setLiveZ(uint8_t cmd)
-{
-	float z = m_live_z;
-	if (cmd == CMD_LIVE_Z_PLUS_COARSE)
-		z += LIVE_Z_COARSE;
-	else if (cmd == CMD_LIVE_Z_PLUS_FINE)
-		z += LIVE_Z_FINE;
-	else if (cmd == CMD_LIVE_Z_RESET)
-		z = LIVE_Z_DEFAULT;
-	else if (cmd == CMD_LIVE_Z_MINUS_FINE)
-		z -= LIVE_Z_COARSE;
-	else if (cmd == CMD_LIVE_Z_MINUS_COARSE)
-		z -= LIVE_Z_COARSE;
-	if (z > LIVE_Z_MAX)
-		z = LIVE_Z_MAX;
-	if (z < LIVE_Z_MIN)
-		z = LIVE_Z_MIN;
-	g_debug("Mesh::setLiveZ(ctrl-%c) old(%0.3f) new(%0.3f)",('A' + cmd - 1),m_live_z,z);
-	m_live_z = z;
-}
+//-------------------------------------------------
+// Mesh bed levelling
+//-------------------------------------------------
+// 1. the mesh starts at whatever MESH_X,MESH_Y (mpos floats)
+//    the machine happens to be at when the $HZ happens
+// 2. uess WIDTH and HEIGHT in mm and STEPS_X and STEPS_Y integers
+// 3. the MESH, and it's 6 parameters are written to a SPIFFS text file
+// 4. readMesh() is from cnc3018.ino() setup after grbl_init() finishes.
+//
+//   If the WIDTH, HEIGHT, STEPS_X, or STEPS_Y have changed the mesh is
+//   invalidated in readMesh().  The MESH_X and MESH_Y are not user params.
+//
+//   The other user params Z_PULLOFF, Z_MAX_TRAVEL, Z_FEED_RATE, and
+//   LINE_SEG_LENGTH can change without invalidating the mesh.
+//
+//   thus readMesh() is also called from group() when one of the given
+//   items is changing at runtime, or once at the end, if they are changed
+//   within a gActions::beginSettings() transaction.
+
+// my test zero is at x=62 y=9
+
+#include "Mesh.h"
+#include "MeshBackend.h"
+#include "BufferedReader.h"
+#include "FluidDebug.h"
+#include "gCounters.h"
+#include "gAxes.h"
+
+#include <MotionControl.h>                      // FluidNC
+#include <System.h>                             // FluidNC
+#include <Machine/MachineConfig.h>              // FluidNC
+#include <Configuration/RuntimeSetting.h>       // FluidNC
+#include <Planner.h>
+
+#include <SPIFFS.h>
+#include <FS.h>
+
+#ifndef USE_LARGE_MESH
+	// This file, Mesh.cpp, contains the only usage of this define.
+	// The _vMachine does not use the mesh.
+	// Otherwise, all it does it define bigger default constants for
+	// the larger cnc20mm.
+	#define USE_LARGE_MESH  0
+#endif
+
+#if USE_LARGE_MESH
+	#pragma message "Using Larger (cnc20mm) mesh constants"
+#else
+	#pragma message "Using Smaller (cnc3018) mesh constants"
+#endif
+
+
+
+#define DEBUG_MESH          1       // upto 3
+#define DEBUG_GET_Z_OFFSET  0
+#define DEBUG_VREVERSE      0       // upto 2
+#define DEBUG_VFORWARD      0
+
+
+#define Z_AXIS       2
+#define Z_AXIS_MASK  0x04
+#define Y_AXIS_MASK  0x02
+
+#if USE_LARGE_MESH
+	#define DEFAULT_MESH_HEIGHT         1100      // mm
+	#define DEFAULT_MESH_WIDTH          1100      // mm
+	#define DEFAULT_MESH_X_STEPS        9         // every 25mm
+	#define DEFAULT_MESH_Y_STEPS        9         // every 20mm
+	#define DEFAULT_MESH_Z_PULLOFF      6.0       // pull off after 0th point
+	#define DEFAULT_MESH_Z_MAX_TRAVEL   -50.0     // mm in negative direction from absolute 0,0
+	#define DEFAULT_MESH_Z_FEED_RATE    80.0      // mm per min
+	#define DEFAULT_MESH_XY_SEEK_RATE   4000.00
+	#define DEFAULT_LINE_SEG_LENGTH     10        // mm
+	#define DEFAULT_NUM_PROBES          1         // count
+#else
+	#define DEFAULT_MESH_HEIGHT         80        // mm
+	#define DEFAULT_MESH_WIDTH          125       // mm
+	#define DEFAULT_MESH_X_STEPS        6         // every 25mm
+	#define DEFAULT_MESH_Y_STEPS        4         // every 20mm
+	#define DEFAULT_MESH_Z_PULLOFF      2.0       // pull off after 0th point
+	#define DEFAULT_MESH_Z_MAX_TRAVEL   -35.0     // mm in negative direction from absolute 0,0
+	#define DEFAULT_MESH_Z_FEED_RATE    20.0      // mm per min
+	#define DEFAULT_MESH_XY_SEEK_RATE   800.00
+	#define DEFAULT_LINE_SEG_LENGTH     2         // mm
+	#define DEFAULT_NUM_PROBES          1         // count
+#endif
+
+
+
+#define MESH_DATA_FILE  "/mesh_data.txt"
+#define MESH_BIN_FILE   "/mesh_data.bin"
+#define MESH_DELIMS     ",\n"
+
+#define MAX_MESH_FILE_SIZE  (sizeof(meshFileHeader_t) + MAX_MESH_X_STEPS * MAX_MESH_Y_STEPS * sizeof(float))
+
+static uint32_t mesh_file_buf[(MAX_MESH_FILE_SIZE + 3) / 4];
+    // The one scratch buffer for whole mesh files, shared by
+    // loadMeshFile() and writeMeshBin().  They are only called
+    // from the task that handles the mesh settings and leveling.
+
+
+
+Mesh::Mesh()
+{
+    m_backend = nullptr;
+    m_is_valid = 0;
+    m_in_leveling = 0;
+	m_cur_step = 0;
+	m_defer_validation = false;
+	m_validation_pending = false;
+
+	m_live_z = 0;
+    m_last_mesh_z = 0;
+	m_num_probes = DEFAULT_NUM_PROBES;
+
+	_height			    = DEFAULT_MESH_HEIGHT;
+	_width			    = DEFAULT_MESH_WIDTH;
+	_x_steps		    = DEFAULT_MESH_X_STEPS;
+	_y_steps		    = DEFAULT_MESH_Y_STEPS;
+	_z_pulloff		    = DEFAULT_MESH_Z_PULLOFF;
+	_z_max_travel	    = DEFAULT_MESH_Z_MAX_TRAVEL;
+	_z_feed_rate	    = DEFAULT_MESH_Z_FEED_RATE;
+	_xy_seek_rate       = DEFAULT_MESH_XY_SEEK_RATE;
+    _line_seg_length    = DEFAULT_LINE_SEG_LENGTH;
+
+	m_slot[0] = 0;
+	m_cfg_width = _width;
+	m_cfg_height = _height;
+	m_cfg_x_steps = _x_steps;
+	m_cfg_y_steps = _y_steps;
+}
+
+
+void Mesh::sizeChanged()
+{
+    // a slot carries its own size, so changing the
+    // size just means it needs to be re-probed
+
+    if (m_slot[0])
+        m_is_valid = false;
+    else
+    {
+        #if DEBUG_MESH
+            g_debug("Mesh::sizeChanged() calling readMesh() for validation");
+        #endif
+        readMesh();
+    }
+}
+
+
+void Mesh::deferValidation(bool defer)
+{
+    m_defer_validation = defer;
+    if (!defer && m_validation_pending)
+    {
+        m_validation_pending = false;
+        if (m_is_valid)
+            sizeChanged();
+    }
+}
+
+
+void Mesh::group(Configuration::HandlerBase& handler) // override
+{
+	handler.item("height", 	    _height);
+	handler.item("width", 		_width);
+	handler.item("x_steps",	    _x_steps);
+	handler.item("y_steps",     _y_steps);
+	handler.item("pulloff",     _z_pulloff);
+	handler.item("max_travel",  _z_max_travel);
+	handler.item("feed_rate",   _z_feed_rate);
+	handler.item("xy_seek_rate",_xy_seek_rate);
+    handler.item("line_seg_len",_line_seg_length);
+	handler.item("num_probes",   m_num_probes);
+	handler.item("select",       _select, 0, MAX_MESH_SLOT_NAME);
+
+	if (m_num_probes > 4)
+		m_num_probes = 4;
+	if (m_num_probes < 1)
+		m_num_probes = 1;
+
+	if (_x_steps > MAX_MESH_X_STEPS)
+		_x_steps = MAX_MESH_X_STEPS;
+	if (_y_steps > MAX_MESH_Y_STEPS)
+		_y_steps = MAX_MESH_Y_STEPS;
+
+
+	// possibly invalidate the mesh upon certain changes
+
+    if (m_is_valid && handler.handlerType() == Configuration::HandlerType::Runtime)
+    {
+        Configuration::RuntimeSetting &rth = static_cast<Configuration::RuntimeSetting &>(handler);
+        if (rth.is("height") ||
+            rth.is("width") ||
+            rth.is("x_steps") ||
+            rth.is("y_steps"))
+        {
+            if (m_defer_validation)
+                m_validation_pending = true;
+            else
+                sizeChanged();
+        }
+    }
+
+	// select a named slot when it changes
+
+	if (handler.handlerType() == Configuration::HandlerType::Runtime &&
+		strcmp(_select.c_str(),m_slot))
+	{
+		Configuration::RuntimeSetting &rth = static_cast<Configuration::RuntimeSetting &>(handler);
+		if (rth.is("select"))
+			selectMesh(_select.c_str());
+	}
+
+
+	// MESH COMMANDS
+	// a weird way to add $commands
+
+	if (handler.handlerType() == Configuration::HandlerType::Runtime)
+	{
+		Configuration::RuntimeSetting &rth = static_cast<Configuration::RuntimeSetting &>(handler);
+		if (rth.is("show"))
+		{
+			debug_mesh();
+			rth.isHandled_ = true;
+		}
+		else if (rth.is("clear"))
+		{
+			invalidateMesh();
+			rth.isHandled_ = true;
+			//int command_result = 237;
+			//handler.item("blah", command_result);
+		}
+		else if (rth.is("counters"))
+		{
+			debug_counters();
+			rth.isHandled_ = true;
+		}
+		else if (rth.is("do_level"))
+		{
+			doMeshLeveling();
+			rth.isHandled_ = true;
+		}
+		else if (rth.is("resume"))
+		{
+			resumeMeshLeveling();
+			rth.isHandled_ = true;
+		}
+		else if (rth.is("save") || rth.is("delete"))
+		{
+			String name;
+			handler.item(rth.is("save") ? "save" : "delete", name, 0, MAX_MESH_SLOT_NAME);
+			if (!rth.is("save"))
+				deleteSlot(name.c_str());
+			else if (!m_is_valid)
+				g_error("MESH: no valid mesh to save");
+			else
+				saveSlot(name.c_str());
+		}
+	}
+
+}
+
+
+
+//--------------------------------------------
+// retrieval API
+//--------------------------------------------
+
+
+float Mesh::getZOffset(float mx, float my)
+    // IN WORK COORDINATES
+{
+    gCount(&g_job_counters.z_offset_calls);
+    if (!m_is_valid)
+    {
+        return 0.00;
+    }
+
+    #if DEBUG_GET_Z_OFFSET
+        g_debug("GET_Z_OFFSET(%5.3f,%5.3f) meshxy(%5.3f,%5.3f)",mx,my,m_mesh_x,m_mesh_y);
+    #endif
+
+    // make mx and my mesh relative
+
+    mx -= m_mesh_x;
+    my -= m_mesh_y;
+
+    #if DEBUG_GET_Z_OFFSET
+        g_debug("   mesh_relxy((%5.3f,%5.3f)",mx,my);
+    #endif
+
+    // develop the integer "box" coordinates
+    // into the mesh array along the percentage
+    // traversed into the box
+
+    int x_left;
+    int x_right;
+    float pct_x;
+    if (mx < 0)
+    {
+        x_left = 0;
+        x_right = 0;
+        pct_x = 1.0;
+    }
+    else
+    {
+        x_left = mx / m_dx;
+        x_right = x_left + 1;
+        if (x_left > _x_steps - 1)
+            x_left = _x_steps - 1;
+        if (x_right > _x_steps - 1)
+            x_right = _x_steps - 1;
+        pct_x = (mx - x_left * m_dx) / m_dx;
+        if (pct_x > 1.0) pct_x = 1.0;
+    }
+
+    int y_top;
+    int y_bottom;
+    float pct_y;
+    if (my < 0)
+    {
+        y_top = 0;
+        y_bottom = 0;
+        pct_y = 1.0;
+    }
+    else
+    {
+        y_bottom = my / m_dy;
+        y_top = y_bottom + 1;
+        if (y_bottom > _y_steps - 1)
+            y_bottom = _y_steps - 1;
+        if (y_top > _y_steps - 1)
+            y_top = _y_steps - 1;
+        pct_y = (my - y_bottom * m_dy) / m_dy;
+    }
+
+    // get the four values
+
+    // when quantized these are the raw counts, and the
+    // decoding is a single multiply of the final value
+
+    float left_bottom =    m_mesh[y_bottom * MAX_MESH_X_STEPS + x_left];	// old: [x_left][y_bottom];
+    float left_top =       m_mesh[y_top    * MAX_MESH_X_STEPS + x_left];    // old: [x_left][y_top];
+    float right_bottom =   m_mesh[y_bottom * MAX_MESH_X_STEPS + x_right];   // old: [x_right][y_bottom];
+    float right_top =      m_mesh[y_top    * MAX_MESH_X_STEPS + x_right];   // old: [x_right][y_top];
+
+    // calculate the contribution
+    //
+    //    lt               rt
+    //
+    //
+    //            o  pct_x,pct_y
+    //
+    //
+    //     lb               rb
+
+    float left = left_bottom + pct_y * (left_top - left_bottom);
+    float right = right_bottom + pct_y * (right_top - right_bottom);
+    float value = left + pct_x * (right - left);
+    #if MESH_QUANTIZED
+        value *= m_mesh_scale;
+    #endif
+
+    #if DEBUG_GET_Z_OFFSET
+        g_debug("   zone_lrtb(%d,%d,%d,%d)  pct_x=%5.3f  pct_y=%5.3f",
+            x_left,
+            x_right,
+            y_top,
+            y_bottom,
+            pct_x,
+            pct_y);
+
+        g_debug("   mesh lb(%5.3f) lt(%5.3f) rb(%5.3f) rt(%5.3f)",
+            left_bottom,
+            left_top,
+            right_bottom,
+            right_top);
+
+        g_debug("   left(%5.3f)  right(%5.3f)  FINAL VALUE(%5.3f)",
+            left,
+            right,
+            value);
+    #endif
+
+    return value;
+
+}
+
+
+
+//--------------------------------------------
+// generation API
+//--------------------------------------------
+
+
+void Mesh::debug_mesh()
+{
+	g_info("MESH%s%s: position=(%0.3f,%0.3f,%0.3f)",m_slot[0]?" ":"",m_slot,m_mesh_x,m_mesh_y,m_zero_point);
+	for (int y=_y_steps-1; y>=0; y--)
+	{
+		static char buf[180];
+		sprintf(buf,"MESH[%d] ",y);
+		for (int x=0; x<_x_steps; x++)
+		{
+			sprintf(&buf[strlen(buf)]," % 6.3f",getMeshValue(x,y));
+		}
+		g_info(buf);
+	}
+}
+
+
+void Mesh::debug_counters()
+{
+	gJobCounters_t &c = g_job_counters;
+	g_info("JOB: %u ms segments=%u retries=%u delay_ms=%u z_offsets=%u",
+		(unsigned) (millis() - c.start_ms),
+		(unsigned) c.segments,
+		(unsigned) c.mc_line_retries,
+		(unsigned) c.delay_ms,
+		(unsigned) c.z_offset_calls);
+	g_info("JOB: planner_empty=%u sd_stalls=%u probes=%u",
+		(unsigned) c.planner_empty,
+		(unsigned) c.sd_stalls,
+		(unsigned) c.probes);
+}
+
+
+void Mesh::init_mesh()
+{
+    #if DEBUG_MESH > 2
+        g_debug("MESH: init_mesh()");
+    #endif
+
+    m_mesh_x = 0.0;
+    m_mesh_y = 0.0;
+
+    m_zero_point = 0.0;
+    m_mesh_scale = MESH_QUANTUM;
+    m_is_valid = false;
+
+    m_dx = _width / (_x_steps-1);
+    m_dy = _height / (_y_steps-1);
+
+	for (int y=0; y<MAX_MESH_Y_STEPS; y++)
+	{
+		for (int x=0; x<MAX_MESH_X_STEPS; x++)
+		{
+            m_mesh[y * MAX_MESH_X_STEPS + x] = 0;
+        }
+    }
+}
+
+
+
+void Mesh::setMeshValue(int x, int y, float value)
+{
+    #if MESH_QUANTIZED
+        long count = lrintf(value / m_mesh_scale);
+        if (count > INT16_MAX || count < -INT16_MAX)
+        {
+            g_error("MESH: value %0.3f at [%d,%d] out of range",value,y,x);
+            count = count > 0 ? INT16_MAX : -INT16_MAX;
+        }
+        m_mesh[y * MAX_MESH_X_STEPS + x] = count;
+    #else
+        m_mesh[y * MAX_MESH_X_STEPS + x] = value;
+    #endif
+}
+
+
+float Mesh::getMeshValue(int x, int y)
+{
+    #if MESH_QUANTIZED
+        return m_mesh[y * MAX_MESH_X_STEPS + x] * m_mesh_scale;
+    #else
+        return m_mesh[y * MAX_MESH_X_STEPS + x];
+    #endif
+}
+
+
+bool Mesh::moveTo(float x, float y)
+    // Move in machine coordinates.  Every move waits to complete: the
+    // probe has to be seen to release before anything moves in xy,
+    // and the g38.2 drains the planner before each probe, so there is
+    // nothing left for the planner to blend between the points.
+{
+    #if DEBUG_MESH > 2
+        g_debug("MESH: _moveTo(%5.3f,%5.3f)",x,y);
+    #endif
+    return m_backend->moveXY(x,y,_xy_seek_rate);
+}
+
+
+bool Mesh::zPullOff(float from)
+    // move z upwards, and check that the probe released
+{
+    // float to = m_zero_point + _z_pulloff;
+
+    float to = from + _z_pulloff;
+
+    #if DEBUG_MESH > 2
+        g_debug("MESH: zPullOff() from=%5.3f to=%5.3f",from,to);
+    #endif
+
+    // 	We use the xy_rate for the pulloff
+
+    if (!m_backend->moveZ(to,_xy_seek_rate))	// old: g_status.getAxisFeedRate(Z_AXIS));
+    {
+        g_error("MESH: zPullOff() move failed");
+        return false;
+    }
+    if (m_backend->probeTripped())
+    {
+        g_error("MESH: zPullOff() failed!");
+        m_backend->pulloffFailed();
+        return false;
+    }
+    return true;
+}
+
+
+
+
+bool Mesh::probeOne(int x, int y, float *zResult)
+    // do a probe and return the z value in absolute machine coordinates
+{
+    #if DEBUG_MESH > 2
+        g_debug("MESH: probeOne()");
+    #endif
+
+    // do upto N probes with heuristics to throw out bad values
+
+
+    bool ok = true;
+    int probe_num = 0;
+	int i_num_probes = m_num_probes;
+    float probe_values[i_num_probes];
+
+    while (ok && probe_num < m_num_probes)
+    {
+		if (m_backend->checkAbort())
+			return false;
+
+        float value = 0;
+        if (m_backend->probe(_z_max_travel,_z_feed_rate,&value))
+        {
+            #if DEBUG_MESH > 1
+                g_debug("MESH[%d,%d] probe[%d]=%f",y,x,probe_num,value);
+            #endif
+            probe_values[probe_num++] = value;
+        }
+        else
+        {
+            ok = false;
+            g_error("MESH: probeOne() probe failed");
+        }
+
+		if (m_backend->checkAbort())
+			return false;
+
+        if (!zPullOff(value))
+			return false;
+    }
+
+    float value = 0;
+    if (ok)
+    {
+        for (int i=0; i<m_num_probes; i++)
+            value += probe_values[i];
+        value /= ((float)m_num_probes);
+
+        #if DEBUG_MESH > 1
+            g_debug("MESH[%d,%d] average=%f",y,x,value);
+        #endif
+
+		if (m_num_probes >= 3)
+		{
+            // throw out the extreme value
+            int max_idx = -1;
+            float max_delta = -1;
+            for (int i=0; i<m_num_probes; i++)
+            {
+                float delta = abs(value-probe_values[i]);
+                if (delta > max_delta)
+                {
+                    max_idx = i;
+                    max_delta = delta;
+                }
+            }
+
+            #if DEBUG_MESH > 1
+                g_debug("MESH[%d,%d] throwing out %d:%f",y,x,max_idx,probe_values[max_idx]);
+            #endif
+
+            value = 0;
+            for (int i=0; i<m_num_probes; i++)
+            {
+                if (i != max_idx)
+                    value += probe_values[i];
+            }
+            value /= ((float)m_num_probes-1);
+
+            #if DEBUG_MESH
+                g_debug("MESH[%d,%d] FINAL AVERAGE=%f",y,x,value);
+            #endif
+		}
+    }
+
+    *zResult = value;
+    return ok;
+}
+
+
+bool Mesh::doMeshLeveling()
+{
+    return levelMesh(false);
+}
+
+
+bool Mesh::resumeMeshLeveling()
+{
+    return levelMesh(true);
+}
+
+
+bool Mesh::levelingFailed()
+    // save whatever points were probed so the run can be resumed
+{
+    writeCheckpoint();
+	m_backend->endLeveling();
+    m_in_leveling = false;
+    return false;
+}
+
+
+bool Mesh::levelMesh(bool resume)
+    // Probe the mesh, checkpointing each point, or, if resume,
+    // continue a previous run from its checkpoint at its origin.
+{
+    m_in_leveling = true;
+	m_cur_step = 0;
+
+    init_mesh();
+
+    static uint16_t done[MAX_MESH_Y_STEPS];     // bitmask of probed x's per row
+    memset(done,0,sizeof(done));
+    if (resume && !readCheckpoint(done))
+    {
+        m_in_leveling = false;
+        return false;
+    }
+
+    if (!m_backend)
+        m_backend = meshDefaultBackend();
+
+    // Finish all queued commands and empty planner buffer before starting probe cycle.
+    // Return if system reset has been issued.
+
+    float mx,my;
+    if (!m_backend->beginLeveling(&mx,&my))
+    {
+        m_in_leveling = false;
+        return false;
+    }
+    if (!resume)
+    {
+        m_mesh_x = mx;
+        m_mesh_y = my;
+        startCheckpoint();
+    }
+
+    #if DEBUG_MESH
+        g_debug("MESH: %s(%5.3f,%5.3f)",resume?"resumeMeshLeveling":"doMeshLeveling",m_mesh_x,m_mesh_y);
+    #endif
+
+    for (int y=0; y<_y_steps; y++)
+    {
+        int start = y & 1 ? _x_steps-1 : 0;
+        int end   = y & 1 ? -1 : _x_steps;
+        int inc   = y & 1 ? -1 : 1;
+
+        for (int x=start; x!=end; x+=inc)
+        {
+			if (m_backend->checkAbort())
+				return levelingFailed();
+
+            if (done[y] & (1 << x))
+            {
+                m_cur_step++;
+                continue;
+            }
+
+            if (moveTo(m_mesh_x + x*m_dx, m_mesh_y + y*m_dy))
+            {
+                float value = 0.0;
+                if (probeOne(x,y,&value))
+                {
+                    if (x==0 && y==0)
+                    {
+                        m_zero_point = value;
+
+                        #if DEBUG_MESH > 1
+                            g_debug("MESH: m_zero_point <= %6.3f",m_zero_point);
+                        #endif
+                    }
+                    else
+                    {
+                        setMeshValue(x,y,value - m_zero_point);
+
+                        #if DEBUG_MESH > 1
+                            g_debug("MESH: m_mesh[%d,%d] <= %6.3f",y,x,getMeshValue(x,y));
+                        #endif
+                    }
+
+                    // the machine is stopped here (the probe has
+                    // released) so it is safe to write
+
+                    addCheckpoint(x,y,value);
+
+                }   // probeOne() succeeded
+                else
+                {
+                    g_error("MESH: probeOne(%d,%d) failed",x,y);
+                    return levelingFailed();
+                }
+            }   // move succeeded
+            else
+            {
+                g_error("MESH: moveTo(%d,%d) failed",x,y);
+                return levelingFailed();
+            }
+
+			m_cur_step++;
+
+        }   // for x_steps
+    }   // for y_steps
+
+    m_backend->endLeveling();
+
+    if (m_backend->checkAbort())
+    {
+        m_in_leveling = false;
+        return false;
+    }
+
+	#if DEBUG_MESH
+	    debug_mesh();
+    #endif
+
+	// move to the original (given) x y position and
+	// z_pulloff above the determined position
+
+	bool ok = m_backend->rapidTo(m_mesh_x,m_mesh_y,m_zero_point + _z_pulloff);
+
+	m_backend->goIdle();
+
+    if (m_backend->checkAbort())
+    {
+        m_in_leveling = false;
+        return false;
+    }
+
+    if (ok && writeMesh())
+    {
+        clearCheckpoint();
+
+		// set the z-zero position from the mesh pulloff position
+
+		m_is_valid = m_backend->setWorkZ(_z_pulloff);
+    }
+
+    m_in_leveling = false;
+
+	#if DEBUG_MESH
+		g_debug("MESH: doMeshLeveling() %s",m_is_valid?"succeeded!":"failed");
+	#endif
+
+    return m_is_valid;
+}
+
+
+//--------------------------------------------
+// Checkpoint
+//--------------------------------------------
+// While leveling, each probed point is appended to MESH_CKPT_FILE,
+// MESH_CKPT_BATCH points at a time (and whenever leveling fails), after
+// a header identifying the mesh. $mesh/resume reads it back and probes
+// only the missing points, at the original origin, so the machine must
+// not have lost its position (i.e. re-home after an alarm). A torn
+// record at the end of the file is ignored.
+
+#define MESH_CKPT_FILE      "/mesh_ckpt.bin"
+#define MESH_CKPT_MAGIC     0x504B434D      // "MCKP"
+#define MESH_CKPT_BATCH     8
+
+typedef struct
+{
+    uint32_t magic;
+    uint8_t  x_steps;
+    uint8_t  y_steps;
+    uint16_t reserved;
+    float    width;
+    float    height;
+    float    mesh_x;
+    float    mesh_y;
+    char     slot[MAX_MESH_SLOT_NAME+1];
+} meshCheckpointHeader_t;
+
+typedef struct
+{
+    uint8_t  x;
+    uint8_t  y;
+    uint16_t check;                         // ~(x | y<<8)
+    float    value;                         // absolute probed z
+} meshCheckpointPoint_t;
+
+static meshCheckpointPoint_t ckpt_pending[MESH_CKPT_BATCH];
+static int ckpt_num_pending = 0;
+
+
+void Mesh::startCheckpoint()
+{
+    ckpt_num_pending = 0;
+
+    meshCheckpointHeader_t header;
+    memset(&header,0,sizeof(header));
+    header.magic = MESH_CKPT_MAGIC;
+    header.x_steps = _x_steps;
+    header.y_steps = _y_steps;
+    header.width = _width;
+    header.height = _height;
+    header.mesh_x = m_mesh_x;
+    header.mesh_y = m_mesh_y;
+    strcpy(header.slot,m_slot);
+
+    File f = SPIFFS.open(MESH_CKPT_FILE, "w");
+    if (!f || f.write((const uint8_t *)&header,sizeof(header)) != sizeof(header))
+        g_error("MESH: could not write %s",MESH_CKPT_FILE);
+    if (f)
+        f.close();
+}
+
+
+void Mesh::addCheckpoint(int x, int y, float value)
+{
+    meshCheckpointPoint_t *point = &ckpt_pending[ckpt_num_pending++];
+    point->x = x;
+    point->y = y;
+    point->check = ~(x | (y << 8));
+    point->value = value;
+    if (ckpt_num_pending == MESH_CKPT_BATCH)
+        writeCheckpoint();
+}
+
+
+void Mesh::writeCheckpoint()
+    // append the pending points to the file
+{
+    if (!ckpt_num_pending)
+        return;
+
+    #if DEBUG_MESH > 1
+        g_debug("MESH: writeCheckpoint(%d)",ckpt_num_pending);
+    #endif
+
+    int size = ckpt_num_pending * sizeof(meshCheckpointPoint_t);
+    File f = SPIFFS.open(MESH_CKPT_FILE, "a");
+    if (!f || f.write((const uint8_t *)ckpt_pending,size) != (size_t) size)
+        g_error("MESH: could not append to %s",MESH_CKPT_FILE);
+    if (f)
+        f.close();
+    ckpt_num_pending = 0;
+}
+
+
+void Mesh::clearCheckpoint()
+{
+    ckpt_num_pending = 0;
+    SPIFFS.remove(MESH_CKPT_FILE);
+}
+
+
+bool Mesh::readCheckpoint(uint16_t *done)
+    // restore the probed points for the current mesh
+    // and set the done bits for them
+{
+    File f = SPIFFS.open(MESH_CKPT_FILE, "r");
+    if (!f)
+    {
+        g_error("MESH: nothing to resume");
+        return false;
+    }
+
+    meshCheckpointHeader_t header;
+    bool ok = f.read((uint8_t *)&header,sizeof(header)) == sizeof(header) &&
+        header.magic == MESH_CKPT_MAGIC;
+    if (!ok)
+        g_error("MESH: %s is corrupt",MESH_CKPT_FILE);
+    else if (header.width != _width ||
+        header.height != _height ||
+        header.x_steps != (int) _x_steps ||
+        header.y_steps != (int) _y_steps ||
+        strcmp(header.slot,m_slot))
+    {
+        g_error("MESH: checkpoint is for a different mesh");
+        ok = false;
+    }
+
+    float values[MAX_MESH_X_STEPS * MAX_MESH_Y_STEPS];
+    int num = 0;
+    meshCheckpointPoint_t point;
+    while (ok && f.read((uint8_t *)&point,sizeof(point)) == sizeof(point))
+    {
+        if (point.check != (uint16_t) ~(point.x | (point.y << 8)) ||
+            point.x >= header.x_steps ||
+            point.y >= header.y_steps)
+            break;
+        if (point.x == 0 && point.y == 0)
+            m_zero_point = point.value;
+        values[point.y * MAX_MESH_X_STEPS + point.x] = point.value;
+        done[point.y] |= 1 << point.x;
+        num++;
+    }
+    f.close();
+
+    // the mesh is relative to the first point
+
+    if (ok && !(done[0] & 1))
+    {
+        g_error("MESH: checkpoint does not have the first point");
+        ok = false;
+    }
+    if (!ok)
+        return false;
+
+    for (int y=0; y<header.y_steps; y++)
+    {
+        for (int x=0; x<header.x_steps; x++)
+        {
+            if (done[y] & (1 << x))
+                setMeshValue(x,y,values[y * MAX_MESH_X_STEPS + x] - m_zero_point);
+        }
+    }
+
+    m_mesh_x = header.mesh_x;
+    m_mesh_y = header.mesh_y;
+
+    // continue appending to the same file
+
+    ckpt_num_pending = 0;
+
+    #if DEBUG_MESH
+        g_debug("MESH: resuming with %d of %d points",num,header.x_steps * header.y_steps);
+    #endif
+    return true;
+}
+
+
+//--------------------------------------------
+// Data File
+//--------------------------------------------
+
+void Mesh::invalidateMesh()
+    // the file(s) of the active mesh, default or slot, are removed
+{
+    #if DEBUG_MESH
+        g_debug("--->invalidateMesh(%s)",m_slot);
+    #endif
+    m_is_valid = false;
+    if (m_slot[0])
+    {
+        deleteSlot(m_slot);
+        return;
+    }
+    SPIFFS.remove(MESH_DATA_FILE);
+    SPIFFS.remove(MESH_BIN_FILE);
+}
+
+
+static uint32_t meshCrc(uint32_t crc, const uint8_t *data, int len)
+    // standard crc32 (as in zip) with a nibble table
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+        0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C };
+
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+    }
+    return ~crc;
+}
+
+
+static float fileValue(const meshFileHeader_t *header, const uint8_t *data, int i)
+{
+    if (header->value_type == MESH_VALUE_FLOAT)
+    {
+        float v;
+        memcpy(&v, &data[i * sizeof(float)], sizeof(float));
+        return v;
+    }
+    int16_t v;
+    memcpy(&v, &data[i * sizeof(int16_t)], sizeof(int16_t));
+    return v * header->scale;
+}
+
+
+static bool loadMeshFile(const char *filename, meshFileHeader_t *header, meshValue_t *values)
+    // Validate and load a binary mesh file with one read, returning
+    // the x_steps * y_steps values in the in-memory representation,
+    // which the header is changed to describe.
+    // _ means it does not use any member variables
+{
+    uint8_t *buf = (uint8_t *) mesh_file_buf;
+
+    File f = SPIFFS.open(filename, "r");
+    if (!f)
+    {
+        g_error("Could not open %s for reading",filename);
+        return false;
+    }
+    int size = f.size();
+    int got = size <= (int) MAX_MESH_FILE_SIZE ? f.read(buf,size) : 0;
+    f.close();
+
+    if (got < (int) sizeof(*header) || got != size)
+    {
+        g_error("Bad mesh file size %d",size);
+        return false;
+    }
+    memcpy(header,buf,sizeof(*header));
+
+    int num = header->x_steps * header->y_steps;
+    uint32_t crc = header->crc;
+    ((meshFileHeader_t *)buf)->crc = 0;
+
+    if (header->magic != MESH_FILE_MAGIC ||
+        header->version != MESH_FILE_VERSION ||
+        (header->value_type == MESH_VALUE_FLOAT && header->value_size != sizeof(float)) ||
+        (header->value_type == MESH_VALUE_INT16 && header->value_size != sizeof(int16_t)) ||
+        header->value_type > MESH_VALUE_INT16 ||
+        header->x_steps < 2 || header->x_steps > MAX_MESH_X_STEPS ||
+        header->y_steps < 2 || header->y_steps > MAX_MESH_Y_STEPS ||
+        size != (int) sizeof(*header) + num * header->value_size ||
+        crc != meshCrc(0,buf,size))
+    {
+        g_error("Mesh file %s is corrupt",filename);
+        return false;
+    }
+
+    #if DEBUG_MESH > 1
+        g_debug("got Mesh Header x,y,w,h,sx,sy,zp: %5.3f,%5.3f,%5.3f,%5.3f,%d,%d,%5.3f",
+            header->mesh_x,
+            header->mesh_y,
+            header->width,
+            header->height,
+            header->x_steps,
+            header->y_steps,
+            header->zero_point);
+    #endif
+
+    const uint8_t *data = &buf[sizeof(*header)];
+    if (header->value_type == MESH_VALUE_TYPE)
+    {
+        memcpy(values, data, num * sizeof(meshValue_t));
+        return true;
+    }
+
+    // convert from the other representation
+
+    #if MESH_QUANTIZED
+        float max = 0;
+        for (int i=0; i<num; i++)
+            max = std::max(max,(float) fabs(fileValue(header,data,i)));
+        float scale = std::max((float) MESH_QUANTUM, max / INT16_MAX);
+        for (int i=0; i<num; i++)
+            values[i] = lrintf(fileValue(header,data,i) / scale);
+    #else
+        float scale = 1.0;
+        for (int i=0; i<num; i++)
+            values[i] = fileValue(header,data,i);
+    #endif
+
+    header->value_type = MESH_VALUE_TYPE;
+    header->value_size = sizeof(meshValue_t);
+    header->scale = scale;
+    return true;
+}
+
+
+void Mesh::getMesh(meshFileHeader_t *header, meshValue_t *values)
+    // the current mesh as a header and x_steps * y_steps values
+{
+    memset(header,0,sizeof(*header));
+    header->magic = MESH_FILE_MAGIC;
+    header->version = MESH_FILE_VERSION;
+    header->value_type = MESH_VALUE_TYPE;
+    header->value_size = sizeof(meshValue_t);
+    header->x_steps = _x_steps;
+    header->y_steps = _y_steps;
+    header->width = _width;
+    header->height = _height;
+    header->mesh_x = m_mesh_x;
+    header->mesh_y = m_mesh_y;
+    header->zero_point = m_zero_point;
+    header->scale = m_mesh_scale;
+
+    for (int y=0; y<header->y_steps; y++)
+        memcpy(&values[y * header->x_steps], &m_mesh[y * MAX_MESH_X_STEPS], header->x_steps * sizeof(meshValue_t));
+}
+
+
+void Mesh::setMesh(const meshFileHeader_t *header, const meshValue_t *values)
+    // make the given mesh, including its size, the current one
+{
+    _width = header->width;
+    _height = header->height;
+    _x_steps = header->x_steps;
+    _y_steps = header->y_steps;
+
+    init_mesh();
+
+    m_mesh_x = header->mesh_x;
+    m_mesh_y = header->mesh_y;
+    m_zero_point = header->zero_point;
+    m_mesh_scale = header->scale;
+
+    for (int y=0; y<header->y_steps; y++)
+        memcpy(&m_mesh[y * MAX_MESH_X_STEPS], &values[y * header->x_steps], header->x_steps * sizeof(meshValue_t));
+}
+
+
+bool Mesh::readMeshBin()
+    // load the default binary mesh file if it matches the config
+{
+    meshFileHeader_t header;
+    meshValue_t values[MAX_MESH_X_STEPS * MAX_MESH_Y_STEPS];
+
+    if (!loadMeshFile(MESH_BIN_FILE,&header,values))
+        return false;
+
+    if (header.width != _width ||
+        header.height != _height ||
+        header.x_steps != (int) _x_steps ||
+        header.y_steps != (int) _y_steps)
+    {
+        g_debug("Mesh Header INVALID!!");
+        return false;
+    }
+
+    setMesh(&header,values);
+    return true;
+}
+
+
+bool Mesh::writeMeshBin(const char *filename)
+{
+    uint8_t *buf = (uint8_t *) mesh_file_buf;
+
+    meshFileHeader_t header;
+    meshValue_t *values = (meshValue_t *) &buf[sizeof(header)];
+    getMesh(&header,values);
+
+    int size = sizeof(header) + header.x_steps * header.y_steps * sizeof(meshValue_t);
+    memcpy(buf,&header,sizeof(header));
+    header.crc = meshCrc(0,buf,size);
+    memcpy(buf,&header,sizeof(header));
+
+    File f = SPIFFS.open(filename, "w");
+    if (!f)
+    {
+        g_error("WARNING: Could not open %s for writing",filename);
+        return false;
+    }
+    bool ok = f.write(buf,size) == (size_t) size;
+    f.close();
+    if (!ok)
+        g_error("There was a problem writing to %s",filename);
+    return ok;
+}
+
+
+//--------------------------------------------
+// Named mesh slots
+//--------------------------------------------
+// Each slot is a binary mesh file /mesh_<name>.bin that carries its own
+// size and origin. Selecting a slot makes it the active mesh, and the
+// size of the mesh, without re-probing, and leveling while a slot is
+// selected (re)writes that slot. The most recently used slots are kept
+// in RAM so switching between a few fixtures does not touch the SPIFFS,
+// each in a malloc'd array the size of its own grid.
+
+typedef struct
+{
+    char     name[MAX_MESH_SLOT_NAME+1];
+    uint32_t last_used;
+    meshFileHeader_t header;
+    meshValue_t *values;        // malloc'd, header.x_steps * header.y_steps
+} meshSlot_t;
+
+static meshSlot_t mesh_slots[MESH_SLOT_CACHE];
+static uint32_t mesh_slot_counter = 0;
+
+
+static void slotFileName(char *buf, const char *name)
+{
+    sprintf(buf,"/mesh_%s.bin",name);
+}
+
+
+static bool validSlotName(const char *name)
+{
+    int len = strlen(name);
+    if (!len || len > MAX_MESH_SLOT_NAME)
+        return false;
+    for (const char *p=name; *p; p++)
+    {
+        if (!isalnum(*p) && *p != '_' && *p != '-')
+            return false;
+    }
+    return true;
+}
+
+
+static meshSlot_t *findSlot(const char *name)
+{
+    for (int i=0; i<MESH_SLOT_CACHE; i++)
+    {
+        if (!strcmp(mesh_slots[i].name,name))
+            return &mesh_slots[i];
+    }
+    return nullptr;
+}
+
+
+static void freeSlot(meshSlot_t *slot)
+{
+    free(slot->values);
+    slot->values = nullptr;
+    slot->name[0] = 0;
+    slot->last_used = 0;
+}
+
+
+static meshSlot_t *newSlot(const char *name, const meshFileHeader_t *header, const meshValue_t *values)
+    // Copy the mesh into the least recently used cache entry.
+    // Returns null if there is not the memory for it, which
+    // only costs a read of the slot's file the next time.
+{
+    meshSlot_t *slot = findSlot(name);
+    if (!slot)
+    {
+        slot = &mesh_slots[0];
+        for (int i=1; i<MESH_SLOT_CACHE; i++)
+        {
+            if (mesh_slots[i].last_used < slot->last_used)
+                slot = &mesh_slots[i];
+        }
+    }
+    freeSlot(slot);
+
+    int num = header->x_steps * header->y_steps;
+    slot->values = (meshValue_t *) malloc(num * sizeof(meshValue_t));
+    if (!slot->values)
+        return nullptr;
+    memcpy(slot->values,values,num * sizeof(meshValue_t));
+    slot->header = *header;
+    strcpy(slot->name,name);
+    slot->last_used = ++mesh_slot_counter;
+    return slot;
+}
+
+
+bool Mesh::selectMesh(const char *name)
+    // "" returns to the default mesh
+{
+    #if DEBUG_MESH
+        g_debug("selectMesh(%s)",name);
+    #endif
+
+    if (!*name)
+    {
+        readMesh();
+        return m_is_valid;
+    }
+    if (!validSlotName(name))
+    {
+        g_error("MESH: invalid slot name '%s'",name);
+        return false;
+    }
+
+    // setMesh() replaces the size with the slot's, so keep
+    // the configured one for when we return to the default
+
+    if (!m_slot[0])
+    {
+        m_cfg_width = _width;
+        m_cfg_height = _height;
+        m_cfg_x_steps = _x_steps;
+        m_cfg_y_steps = _y_steps;
+    }
+    strcpy(m_slot,name);
+    m_is_valid = false;
+
+    meshSlot_t *slot = findSlot(name);
+    if (slot)
+    {
+        slot->last_used = ++mesh_slot_counter;
+        setMesh(&slot->header,slot->values);
+    }
+    else
+    {
+        char filename[40];
+        slotFileName(filename,name);
+        if (!SPIFFS.exists(filename))
+        {
+            g_info("MESH: slot %s is empty",name);
+            init_mesh();
+            return false;
+        }
+        meshFileHeader_t header;
+        meshValue_t values[MAX_MESH_X_STEPS * MAX_MESH_Y_STEPS];
+        if (!loadMeshFile(filename,&header,values))
+        {
+            init_mesh();
+            return false;
+        }
+        newSlot(name,&header,values);
+        setMesh(&header,values);
+    }
+    m_is_valid = true;
+
+    #if DEBUG_MESH
+        g_debug("selectMesh(%s) VALID!!",name);
+        debug_mesh();
+    #endif
+    return true;
+}
+
+
+bool Mesh::saveSlot(const char *name)
+    // write the current mesh to the given slot
+{
+    if (!validSlotName(name))
+    {
+        g_error("MESH: invalid slot name '%s'",name);
+        return false;
+    }
+
+    char filename[40];
+    slotFileName(filename,name);
+    if (!writeMeshBin(filename))
+        return false;
+
+    meshFileHeader_t header;
+    meshValue_t values[MAX_MESH_X_STEPS * MAX_MESH_Y_STEPS];
+    getMesh(&header,values);
+    newSlot(name,&header,values);
+    return true;
+}
+
+
+void Mesh::deleteSlot(const char *name)
+{
+    if (!validSlotName(name))
+        return;
+
+    meshSlot_t *slot = findSlot(name);
+    if (slot)
+        freeSlot(slot);
+
+    char filename[40];
+    slotFileName(filename,name);
+    SPIFFS.remove(filename);
+
+    if (!strcmp(name,m_slot))
+        m_is_valid = false;
+}
+
+
+static bool sameFloat(float a, float b)
+    // the text file has 3 decimal places
+{
+    return fabs(a - b) < 0.0005;
+}
+
+
+void Mesh::readMesh()
+    // Load the selected slot, if any, or the default mesh,
+    // preferring the binary file, falling back to (and
+    // re-creating the binary file from) the text file.
+{
+    #if DEBUG_MESH > 1
+        g_debug("readMesh()");
+    #endif
+
+    if (_select.length())
+    {
+        selectMesh(_select.c_str());
+        return;
+    }
+
+    // back from a slot, the default mesh is checked against
+    // the configured size, not the slot's, which would fail
+    // and delete it
+
+    if (m_slot[0])
+    {
+        m_slot[0] = 0;
+        _width = m_cfg_width;
+        _height = m_cfg_height;
+        _x_steps = m_cfg_x_steps;
+        _y_steps = m_cfg_y_steps;
+    }
+    init_mesh();
+
+    bool ok = false;
+    bool exists = false;
+    if (SPIFFS.exists(MESH_BIN_FILE))
+    {
+        exists = true;
+        ok = readMeshBin();
+    }
+    if (!ok && SPIFFS.exists(MESH_DATA_FILE))
+    {
+        exists = true;
+        init_mesh();
+        ok = readMeshText();
+
+        // the text file is still good if the binary one
+        // cannot be re-created, which is just slower to load
+
+        if (ok && !writeMeshBin(MESH_BIN_FILE))
+            SPIFFS.remove(MESH_BIN_FILE);
+    }
+
+    if (ok)
+    {
+        #if DEBUG_MESH
+            g_debug("readMesh() VALID!!");
+            debug_mesh();
+        #endif
+        m_is_valid = true;
+    }
+    else if (exists)
+        invalidateMesh();
+}
+
+
+bool Mesh::readMeshText()
+{
+    bool ok = false;
+    File f = SPIFFS.open(MESH_DATA_FILE, "r");
+    if (f)
+    {
+        BufferedReader reader(f);
+        float header[7];
+        if (reader.readFloat(&header[0],MESH_DELIMS) &&
+            reader.readFloat(&header[1],MESH_DELIMS) &&
+            reader.readFloat(&header[2],MESH_DELIMS) &&
+            reader.readFloat(&header[3],MESH_DELIMS) &&
+            reader.readFloat(&header[4],MESH_DELIMS) &&
+            reader.readFloat(&header[5],MESH_DELIMS) &&
+            reader.readFloat(&header[6],MESH_DELIMS))
+        {
+            #if DEBUG_MESH > 1
+                g_debug("got Mesh Header x,y,w,h,sx,sy,zp: %5.3f,%5.3f,%5.3f,%5.3f,%1.0f,%1.0f,%5.3f",
+                    header[0],
+                    header[1],
+                    header[2],
+                    header[3],
+                    header[4],
+                    header[5],
+                    header[6]);
+            #endif
+
+            if (sameFloat(header[2],_width) &&
+                sameFloat(header[3],_height) &&
+                header[4] == _x_steps &&
+                header[5] == _y_steps)
+            {
+                #if DEBUG_MESH > 1
+                    g_debug("Mesh Header Valid - reading mesh");
+                #endif
+
+                ok = true;
+
+                m_mesh_x = header[0];
+                m_mesh_y = header[1];
+                m_zero_point = header[6];
+
+                for (int y=0; ok && (y<_y_steps); y++)
+                {
+                    for (int x=0; ok && (x<_x_steps); x++)
+                    {
+                        float value;
+                        if (reader.readFloat(&value,MESH_DELIMS))
+                            setMeshValue(x,y,value);
+                        else
+                        {
+                            ok = false;
+                            g_error("Could not read mesh value(%d,%d)",y,x);
+                        }
+                    }
+                }
+            }
+            else
+            {
+                g_debug("Mesh Header INVALID!!");
+            }
+        }
+        else
+        {
+            g_error("Could not read mesh header");
+        }
+
+        f.close();
+
+    }   // file opened
+
+    else
+    {
+        g_error("Could not open %s for reading",MESH_DATA_FILE);
+    }
+
+    return ok;
+}
+
+
+
+bool writeFloat(File f, float v, bool newline=true, bool prec_comma=false)
+{
+    char buf[18];
+    sprintf(buf,"%-5.3f",v);
+    if (prec_comma)
+        if (f.print(",") != 1)
+            return false;
+    if (f.print(buf) != strlen(buf))
+        return false;
+    if (newline)
+        if (f.print("\n") != 1)
+            return false;
+    return true;
+}
+
+
+bool Mesh::writeMesh()
+{
+    g_debug("writeMesh(%s)",m_slot);
+    if (m_slot[0])
+        return saveSlot(m_slot);
+    if (!writeMeshBin(MESH_BIN_FILE))
+    {
+        invalidateMesh();
+        return false;
+    }
+    bool ok = false;
+    File f = SPIFFS.open(MESH_DATA_FILE, "w");
+    if (f)
+    {
+        if (writeFloat(f,m_mesh_x) &&
+            writeFloat(f,m_mesh_y) &&
+            writeFloat(f,_width) &&
+            writeFloat(f,_height) &&
+            writeFloat(f,_x_steps) &&
+            writeFloat(f,_y_steps) &&
+            writeFloat(f,m_zero_point))
+        {
+            ok = true;
+            for (int y=0;ok && (y<_y_steps); y++)
+            {
+                for (int x=0;ok && (x<_x_steps); x++)
+                {
+                    if (!writeFloat(f,getMeshValue(x,y),false,x>0))
+                        ok = false;
+                }
+                if (f.print("\n") != 1)
+                    ok = false;
+            }
+        }
+
+        f.close();
+        if (!ok)
+        {
+            g_error("There was a problem writing to %s",MESH_DATA_FILE);
+            invalidateMesh();
+        }
+        return ok;
+    }
+    g_error("WARNING: Could not open %s for writing",MESH_DATA_FILE);
+    invalidateMesh();
+    return false;
+}
+
+
+
+//  #if MESH_USER_DEFINED_HOMING
+//  	bool Mesh::user_defined_homing(AxisMask axisMask)
+//  	{
+//  		// $HZ builds the mesh
+//  		// $HY invalidates the mesh
+//
+//  		if (axisMask == Y_AXIS_MASK)
+//  		{
+//  			g_debug("Mesh::user_defined_homing Y calling invalidateMesh()");
+//  			invalidateMesh();
+//  			return true;
+//  		}
+//
+//  		if (axisMask == Z_AXIS_MASK)
+//  		{
+//  			g_debug("Mesh::user_defined_homing Z calling doMeshLeveling()");
+//  			doMeshLeveling();
+//  			return true;
+//  		}
+//
+//  		return false;
+//  	}
+//  #endif
+
+
+//======================================================================
+// implement "kinematics" to shoehorn the mesh into FluidNC
+//======================================================================
+
+bool Mesh::cartesian_to_motors(float* target, plan_line_data_t* pl_data, float* position)
+    // THE REALTIME Z IS POSITIVE TO MOVE THE HEAD UP and NEGATIVE to move the head DOWN
+    // my cut depth was 0.2 and I ended up setting the realtimeZOffset to 0.15, making
+    // my effective cut depth 0.05 .. and that was still deep, but you have to account
+    // for the tip breaking off of the bit in the first few minutes and becoming dull
+    // over an entire run..
+    //
+    // given a target and initial position in Machine Coordinates
+    // call mc_line() to move to the new position possibly including
+    // the mesh z offset
+{
+    float tpos[MAX_N_AXIS];
+    float new_pos[MAX_N_AXIS];
+    int n_axis = config->_axes->_numberAxis;
+        // all of the yaml's axes are passed to mc_line(), and are
+        // interpolated over the segments, the first MESH_NUM_AXIS
+        // with the fixed size loops, and any others (i.e. a rotary)
+        // after them.
+
+	#if DEBUG_VREVERSE
+		g_debug("C2M from(%5.3f,%5.3f,%5.3f) to (%5.3f,%5.3f,%5.3f)",
+			position[X_AXIS],
+            position[Y_AXIS],
+            position[Z_AXIS],
+            target[X_AXIS],
+            target[Y_AXIS],
+            target[Z_AXIS]);
+	#endif
+
+    // if the mesh is not valid, just call a single mc_line()
+    // for the entire traversal
+
+    if (!m_is_valid ||
+        sys.state == State::Homing)
+    {
+        memcpy(new_pos,target,n_axis * sizeof(float));
+
+		// ADD the live_z to the motor position
+
+		if (sys.state != State::Homing)
+			new_pos[Z_AXIS] += m_live_z;
+
+        gCount(&g_job_counters.segments);
+        if (!mc_line(new_pos, pl_data))
+			return false;
+        return true;
+    }
+
+    memcpy(new_pos,position,n_axis * sizeof(float));
+
+    // break the x/y portion of the line up into multiple segments,
+    // moving any other axes (i.e. a rotary) along with them
+
+	uint32_t num_segs = 1;
+	float xdist = target[X_AXIS] - new_pos[X_AXIS];
+	float ydist = target[Y_AXIS] - new_pos[Y_AXIS];
+	float zdist = target[Z_AXIS] - new_pos[Z_AXIS];
+
+	if (!pl_data->motion.rapidMotion && (xdist!=0 || ydist!=0))
+	{
+		float dist = sqrt(xdist*xdist + ydist*ydist + zdist*zdist);
+		float f_num_segs = (dist + (_line_seg_length/2))/_line_seg_length;
+		num_segs = f_num_segs;
+		if (!num_segs) num_segs = 1;
+	}
+
+	//--------------------
+	// do loop of segments
+	//--------------------
+
+	float inc[MAX_N_AXIS];
+	axesDelta<MESH_NUM_AXIS>(inc,target,new_pos,1.0 / num_segs);
+	for (int i=MESH_NUM_AXIS; i<n_axis; i++)
+		inc[i] = (target[i] - new_pos[i]) / num_segs;
+
+	#if DEBUG_VREVERSE
+		g_debug("C2M doing %d segments with incs(%5.3f,%5.3f,%5.3f)",
+			num_segs,
+			inc[X_AXIS],
+			inc[Y_AXIS],
+			inc[Z_AXIS]);
+	#endif
+
+	for (uint32_t seg_num=0; seg_num<num_segs; seg_num++)
+	{
+		axesAdd<MESH_NUM_AXIS>(new_pos,inc);
+		for (int i=MESH_NUM_AXIS; i<n_axis; i++)
+			new_pos[i] += inc[i];
+
+        // we need a working copy of the position
+        // so that we don't accumulate zOffsets
+
+        memcpy(tpos,new_pos,n_axis * sizeof(float));
+
+		// ADD the live_z to the motor position
+
+		tpos[Z_AXIS] += m_live_z;
+
+        // get the zOffset at the work position
+        // and add it to the working copy
+
+        float zoff = getZOffset(new_pos[X_AXIS],new_pos[Y_AXIS]);
+        tpos[Z_AXIS] += zoff;
+
+        // to see values in Arduino plotter:
+        // Uart0.printf("%5.3f,%5.3f,%5.3f\r\n",realtimeZOffset,position[Z_AXIS]+24.222,zoff);
+
+		#if DEBUG_VREVERSE>1
+			g_debug("C2M seg(%d) to(%5.3f,%5.3f,%5.3f) zoff=%5.3f",
+				seg_num,
+				tpos[X_AXIS],
+				tpos[Y_AXIS],
+				tpos[Z_AXIS],
+				zoff);
+		#endif
+
+		delay(5);	// IMPORTANT: let other tasks run
+		gCount(&g_job_counters.delay_ms,5);
+		gCount(&g_job_counters.segments);
+
+		// hmmm ... i thought mc_line failing was the problem,
+		// but this code is never executed (I think it was the
+		// dealy that was needed).  And maybe $message/level=DEBUG
+		// helped by emulating that
+
+		int problem_reported = 0;
+		while (!mc_line(tpos, pl_data))
+		{
+			if (sys.abort)
+			{
+				log_error("SYS_ABORT FROM MESH MC_LINE FAIL!!!");
+				return false;
+			}
+			// report the problem once per second
+			// forever with a seconds counter
+			if (problem_reported++ % 100 == 0)
+				log_info("MESH MC_LINE_FAILED " << problem_reported/100);
+			delay(10);
+			gCount(&g_job_counters.mc_line_retries);
+			gCount(&g_job_counters.delay_ms,10);
+		}
+
+	}	// for each segment
+
+    return true;
+
+}
+
+
+//--------------------------------------------------------------------------------------------------------
+// motors_to_cartesian
+//--------------------------------------------------------------------------------------------------------
+
+void Mesh::motors_to_cartesian(float* cartesian, float* motors, int n_axis)
+    // the input variable "motors" is "machine position"
+    // the output variable is "cartesian"
+{
+    // the only thing we might change is the Z
+
+    memcpy(cartesian,motors,n_axis * sizeof(float));
+
+    static bool axes_reported = false;
+    if (n_axis != MESH_NUM_AXIS && !axes_reported)
+    {
+        axes_reported = true;
+        g_error("MESH: MESH_NUM_AXIS(%d) does not match the %d axes in the yaml",MESH_NUM_AXIS,n_axis);
+    }
+
+	// SUBTRACT out the live z
+	// if it's negative we added it during cartesian_to_motors()
+
+    cartesian[Z_AXIS] -= m_live_z;
+
+    // if the mesh is not valid, just return the input
+
+    if (!m_is_valid ||
+        sys.state == State::Homing)
+        return;
+
+    // get the zOffset at the location
+    // and subtract it from the z location
+
+    float zoff = m_last_mesh_z = getZOffset(motors[X_AXIS],motors[Y_AXIS]);
+
+    #if DEBUG_VFORWARD
+        g_debug("M2C(%5.3f,%5.3f,%5.3f) subtracting z_offset(%5.3f)",
+            motors[X_AXIS],
+            motors[Y_AXIS],
+            motors[Z_AXIS],
+            zoff);
+    #endif
+
+    cartesian[Z_AXIS] -= zoff;
+}
+
+
+void  Mesh::setLiveZ(uint8_t cmd)
+{
+	float z = m_live_z;
+	if (cmd == CMD_LIVE_Z_PLUS_COARSE)
+		z += LIVE_Z_COARSE;
+	else if (cmd == CMD_LIVE_Z_PLUS_FINE)
+		z += LIVE_Z_FINE;
+	else if (cmd == CMD_LIVE_Z_RESET)
+		z = LIVE_Z_DEFAULT;
+	else if (cmd == CMD_LIVE_Z_MINUS_FINE)
+		z -= LIVE_Z_COARSE;
+	else if (cmd == CMD_LIVE_Z_MINUS_COARSE)
+		z -= LIVE_Z_COARSE;
+	if (z > LIVE_Z_MAX)
+		z = LIVE_Z_MAX;
+	if (z < LIVE_Z_MIN)
+		z = LIVE_Z_MIN;
+	g_debug("Mesh::setLiveZ(ctrl-%c) old(%0.3f) new(%0.3f)",('A' + cmd - 1),m_live_z,z);
+	m_live_z = z;
+}
@@ -1,125 +1,234 @@
-// cnc3018.h
-
-#pragma once
-
-#include <Configuration/Configurable.h> // FluidNC
-#include <Planner.h>                    // FluidNC
-
-// maximum mesh is big enough for 20mm grid on 3018 machine
-// and occupies about 1/2K of memory
-
-#define MAX_MESH_X_STEPS  12
-#define MAX_MESH_Y_STEPS  12
-
-
-// these constants are here for use by multiple clients
-// but not used in this object
-
-
-#define LIVE_Z_MIN      -2.000
-#define LIVE_Z_MAX       2.000
-#define LIVE_Z_DEFAULT   0.000
-#define LIVE_Z_COARSE    0.020
-#define LIVE_Z_FINE      0.002
-
-#define CMD_LIVE_Z_PLUS_COARSE   0x11   // ctrl-Q
-#define CMD_LIVE_Z_PLUS_FINE     0x17	// ctrl-W
-#define CMD_LIVE_Z_RESET         0x05	// ctrl-E
-#define CMD_LIVE_Z_MINUS_FINE    0x12	// ctrl-R
-#define CMD_LIVE_Z_MINUS_COARSE  0x14	// ctrl-T
-
-
-class Mesh : public Configuration::Configurable
-{
-    public:
-
-        Mesh();
-
-        bool doMeshLeveling();
-
-        bool isValid()         { return m_is_valid; }
-        bool inLeveling()      { return m_in_leveling; }
-            // to suppress various debug messages in other objects
-
-        void readMesh();
-            // called from setup() once to initially load the mesh from
-            // the file.  Self invalidates if the parameters have changed
-            // since creation. Also self invalidates via RuntimeSetting
-            // changes in group()
-
-        bool cartesian_to_motors(float* target, plan_line_data_t* pl_data, float* position);
-        void motors_to_cartesian(float* cartesian, float* motors, int n_axis);
-
-        int getNumSteps()       { return ((int) _x_steps) * ((int)_y_steps); }
-        int getCurStep()        { return m_cur_step; }
-        float getZPulloff()     { return _z_pulloff; }
-        float getZeroPos()      { return m_zero_point; }
-
-        float getHeight()       { return _height; }
-        float getWidth()        { return _width; }
-        int   getXSteps()       { return _x_steps; }
-        int   getYSteps()       { return _y_steps; }
-        int   getNumProbes()    { return m_num_probes; }
-
-        void  setLiveZ(uint8_t cmd);
-        float getLiveZ()        { return m_live_z; }
-        float getLastMeshZ()    { return m_last_mesh_z; }
-
-    private:
-
-        float m_mesh_x;     // position of mesh
-        float m_mesh_y;
-
-        // config variables
-
-        float _height;
-        float _width;
-        float _x_steps;
-        float _y_steps;
-
-        float _z_pulloff;
-        float _z_max_travel;
-        float _z_feed_rate;
-        float _xy_seek_rate;
-        float _line_seg_length;
-
-        float  m_num_probes;
-        volatile float m_live_z;
-        float  m_last_mesh_z;
-
-        // working variables
-
-        int     m_cur_step;                                 // which step are we on
-        bool    m_in_leveling;                              // true while in doMeshLeveling
-        bool    m_is_valid;                                 // mesh levelling has completed
-        float   m_zero_point;                               // the absolute machine position of z=0 at xy=0,0 (5,5)
-        float   m_mesh[MAX_MESH_X_STEPS * MAX_MESH_Y_STEPS]; // the mesh
-        float   m_dx;                                       // size of a step in machine coordinates
-        float   m_dy;
-
-        // FluidNC::Configurable api
-
-        void group(Configuration::HandlerBase& handler) override;
-
-        // implementation
-
-        void debug_mesh();
-        void init_mesh();
-        void invalidateMesh();
-
-        bool moveTo(float x, float y);
-        bool probeOne(int x, int y, float *zResult);
-        bool zPullOff(float from);
-        bool writeMesh();
-
-        float getZOffset(float mx, float my);
-            // After doMeshLeveling() works, m_is_valid will be true and one can
-            // call getZOffset with mx,my in machine coordinates to get the
-            // interpolated mesh z offset at that point.
-
-};  // class Mesh
-
-
-extern Mesh the_mesh;
-    // If you include Mesh.h, you MUST declare the instance
-    // in one of your sketch ino or cpp files!
+// cnc3018.h
+
+#pragma once
+
+#include <Configuration/Configurable.h> // FluidNC
+#include <Planner.h>                    // FluidNC
+
+class MeshBackend;
+
+// maximum mesh is big enough for 20mm grid on 3018 machine
+// and occupies about 1/2K of memory
+
+#define MAX_MESH_X_STEPS  12
+#define MAX_MESH_Y_STEPS  12
+
+// the number of axes cartesian_to_motors() moves, which must be the
+// number in the yaml. Fixed at compile time so that its per segment
+// copies are unrolled.
+
+#ifndef MESH_NUM_AXIS
+    #define MESH_NUM_AXIS   3
+#endif
+
+// named mesh slots, of which the most recently used are cached in RAM
+
+#define MESH_SLOT_CACHE     3
+#define MAX_MESH_SLOT_NAME  15
+
+// The binary mesh file is a meshFileHeader_t followed by x_steps * y_steps
+// values in row (y) major order, either floats or int16's in units of
+// the header scale, and is loaded with a single read. The crc covers the
+// header (with crc=0) and the values. The text file is still written
+// alongside it for people, but the binary one is preferred at boot.
+
+#define MESH_FILE_MAGIC     0x4853454D      // "MESH"
+#define MESH_FILE_VERSION   1
+
+#define MESH_VALUE_FLOAT    0
+#define MESH_VALUE_INT16    1
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint8_t  value_type;
+    uint8_t  value_size;
+    uint8_t  x_steps;
+    uint8_t  y_steps;
+    uint16_t reserved;
+    float    width;
+    float    height;
+    float    mesh_x;
+    float    mesh_y;
+    float    zero_point;
+    float    scale;                         // mm per count for int values
+    uint32_t crc;
+} meshFileHeader_t;
+
+// With MESH_QUANTIZED the mesh is stored as int16 counts of a per-mesh
+// scale (MESH_QUANTUM, a micron, unless the mesh needs more range),
+// halving its memory and cache footprint.
+
+#ifndef MESH_QUANTIZED
+    #define MESH_QUANTIZED  0
+#endif
+
+#if MESH_QUANTIZED
+    typedef int16_t meshValue_t;
+    #define MESH_VALUE_TYPE     MESH_VALUE_INT16
+    #define MESH_QUANTUM        0.001
+#else
+    typedef float meshValue_t;
+    #define MESH_VALUE_TYPE     MESH_VALUE_FLOAT
+    #define MESH_QUANTUM        1.0
+#endif
+
+
+// these constants are here for use by multiple clients
+// but not used in this object
+
+
+#define LIVE_Z_MIN      -2.000
+#define LIVE_Z_MAX       2.000
+#define LIVE_Z_DEFAULT   0.000
+#define LIVE_Z_COARSE    0.020
+#define LIVE_Z_FINE      0.002
+
+#define CMD_LIVE_Z_PLUS_COARSE   0x11   // ctrl-Q
+#define CMD_LIVE_Z_PLUS_FINE     0x17	// ctrl-W
+#define CMD_LIVE_Z_RESET         0x05	// ctrl-E
+#define CMD_LIVE_Z_MINUS_FINE    0x12	// ctrl-R
+#define CMD_LIVE_Z_MINUS_COARSE  0x14	// ctrl-T
+
+
+class Mesh : public Configuration::Configurable
+{
+    public:
+
+        Mesh();
+
+        bool doMeshLeveling();
+        bool resumeMeshLeveling();
+            // continue a failed doMeshLeveling() from its checkpoint
+
+        void setBackend(MeshBackend *backend)   { m_backend = backend; }
+            // defaults to meshDefaultBackend() (FluidNC) on the first
+            // doMeshLeveling() if not set. See MeshBackend.h
+
+        bool isValid()         { return m_is_valid; }
+        bool inLeveling()      { return m_in_leveling; }
+            // to suppress various debug messages in other objects
+
+        void readMesh();
+            // called from setup() once to initially load the mesh from
+            // the file.  Self invalidates if the parameters have changed
+            // since creation. Also self invalidates via RuntimeSetting
+            // changes in group()
+        void deferValidation(bool defer);
+            // while deferred, size changes in group() are only noted,
+            // and the mesh is validated once when it is undeferred.
+            // Used by gActions::beginSettings() and commitSettings()
+
+        bool cartesian_to_motors(float* target, plan_line_data_t* pl_data, float* position);
+        void motors_to_cartesian(float* cartesian, float* motors, int n_axis);
+
+        int getNumSteps()       { return ((int) _x_steps) * ((int)_y_steps); }
+        int getCurStep()        { return m_cur_step; }
+        float getZPulloff()     { return _z_pulloff; }
+        float getZeroPos()      { return m_zero_point; }
+
+        float getHeight()       { return _height; }
+        float getWidth()        { return _width; }
+        int   getXSteps()       { return _x_steps; }
+        int   getYSteps()       { return _y_steps; }
+        int   getNumProbes()    { return m_num_probes; }
+
+        void  setLiveZ(uint8_t cmd);
+        float getLiveZ()        { return m_live_z; }
+        float getLastMeshZ()    { return m_last_mesh_z; }
+
+        const char *getSlotName() { return m_slot; }
+            // "" for the default mesh
+
+    private:
+
+        float m_mesh_x;     // position of mesh
+        float m_mesh_y;
+
+        // config variables
+
+        float _height;
+        float _width;
+        float _x_steps;
+        float _y_steps;
+
+        float _z_pulloff;
+        float _z_max_travel;
+        float _z_feed_rate;
+        float _xy_seek_rate;
+        float _line_seg_length;
+        String _select;
+
+        float  m_num_probes;
+        volatile float m_live_z;
+        float  m_last_mesh_z;
+
+        // working variables
+
+        MeshBackend *m_backend;                             // the machine doing the probing
+        int     m_cur_step;                                 // which step are we on
+        bool    m_in_leveling;                              // true while in doMeshLeveling
+        bool    m_is_valid;                                 // mesh levelling has completed
+        bool    m_defer_validation;                         // see deferValidation()
+        bool    m_validation_pending;                       // a size changed while deferred
+        char    m_slot[MAX_MESH_SLOT_NAME+1];               // the selected slot, "" for the default mesh
+        float   m_cfg_width;                                // the configured size, while a slot
+        float   m_cfg_height;                               // has replaced it with its own
+        float   m_cfg_x_steps;
+        float   m_cfg_y_steps;
+        float   m_zero_point;                               // the absolute machine position of z=0 at xy=0,0 (5,5)
+        meshValue_t m_mesh[MAX_MESH_X_STEPS * MAX_MESH_Y_STEPS]; // the mesh
+        float   m_mesh_scale;                               // mm per count if MESH_QUANTIZED
+        float   m_dx;                                       // size of a step in machine coordinates
+        float   m_dy;
+
+        // FluidNC::Configurable api
+
+        void group(Configuration::HandlerBase& handler) override;
+
+        // implementation
+
+        void debug_mesh();
+        void debug_counters();
+            // the per-job counters from gCounters.h
+        void init_mesh();
+        void invalidateMesh();
+        void sizeChanged();
+
+        bool levelMesh(bool resume);
+        bool levelingFailed();
+
+        void startCheckpoint();
+        void addCheckpoint(int x, int y, float value);
+        void writeCheckpoint();
+        void clearCheckpoint();
+        bool readCheckpoint(uint16_t *done);
+
+        bool moveTo(float x, float y);
+        bool probeOne(int x, int y, float *zResult);
+        bool zPullOff(float from);
+        bool writeMesh();
+        bool writeMeshBin(const char *filename);
+        bool readMeshBin();
+        bool readMeshText();
+
+        void getMesh(meshFileHeader_t *header, meshValue_t *values);
+        void setMesh(const meshFileHeader_t *header, const meshValue_t *values);
+        void setMeshValue(int x, int y, float value);
+        float getMeshValue(int x, int y);
+        bool selectMesh(const char *name);
+        bool saveSlot(const char *name);
+        void deleteSlot(const char *name);
+
+        float getZOffset(float mx, float my);
+            // After doMeshLeveling() works, m_is_valid will be true and one can
+            // call getZOffset with mx,my in machine coordinates to get the
+            // interpolated mesh z offset at that point.
+
+};  // class Mesh
+
+
+extern Mesh the_mesh;
+    // If you include Mesh.h, you MUST declare the instance
+    // in one of your sketch ino or cpp files!
@@ -0,0 +1,155 @@
+//-------------------------------------------------
+// FluidNC implementation of the MeshBackend
+//-------------------------------------------------
+
+#include "MeshBackend.h"
+#include "FluidDebug.h"
+
+#include <GCode.h>                              // FluidNC
+#include <MotionControl.h>                      // FluidNC
+#include <Protocol.h>                           // FluidNC
+#include <Report.h>                             // FluidNC
+#include <Serial.h>                             // FluidNC
+#include <System.h>                             // FluidNC
+#include <Uart.h>                               // FluidNC
+#include <Machine/MachineConfig.h>              // FluidNC
+
+
+#define DEBUG_MESH_BACKEND  0
+
+
+MeshBackend *meshDefaultBackend()
+{
+    static MeshFluidNC fluidnc_backend;
+    return &fluidnc_backend;
+}
+
+
+static bool _mesh_execute(char *buf)
+    // run the move and wait for it to complete
+{
+    #if DEBUG_MESH_BACKEND
+        g_debug("MESH: _mesh_execute(%s)",buf);
+    #endif
+
+    Error rslt = gc_execute_line(buf, Uart0);
+    if (rslt != Error::Ok)
+    {
+        report_status_message(rslt, allClients);
+        g_error("MESH: gc_execute_line(%s) failed",buf);
+        return false;
+    }
+    protocol_buffer_synchronize();
+    if (sys.abort)
+    {
+        g_error("MESH: move aborted");
+        return false;           // Bail to main() program loop to reset system.
+    }
+    #if DEBUG_MESH_BACKEND
+        g_debug("MESH: move completed");
+    #endif
+    return true;
+}
+
+
+bool MeshFluidNC::beginLeveling(float *mx, float *my)
+{
+    // Finish all queued commands and empty planner buffer before starting probe cycle.
+    // Return if system reset has been issued.
+
+    protocol_buffer_synchronize();
+    if (sys.abort)
+        return false;
+
+	sys.state = State::Idle;
+	config->_stepping->beginLowLatency();
+
+    *mx = steps_to_mpos(motor_steps[X_AXIS],X_AXIS);
+    *my = steps_to_mpos(motor_steps[Y_AXIS],Y_AXIS);
+    return true;
+}
+
+
+void MeshFluidNC::endLeveling()
+{
+	config->_stepping->endLowLatency();
+}
+
+
+bool MeshFluidNC::moveXY(float x, float y, float feed)
+{
+    char buf[80];
+    sprintf(buf,"g1 g53 x%5.3f y%5.3f f%5.3f",x,y,feed);
+    return _mesh_execute(buf);
+}
+
+
+bool MeshFluidNC::moveZ(float z, float feed)
+{
+    char buf[80];
+    sprintf(buf,"g1 g53 z%5.3f f%5.3f",z,feed);
+    return _mesh_execute(buf);
+}
+
+
+bool MeshFluidNC::rapidTo(float x, float y, float z)
+{
+    char buf[80];
+    sprintf(buf,"g0 g53 x%5.3f y%5.3f z%5.3f",x,y,z);
+    return _mesh_execute(buf);
+}
+
+
+bool MeshFluidNC::probe(float z, float feed, float *zResult)
+{
+    char buf[60];
+    sprintf(buf,"g38.2 z%5.3f f%5.3f",z,feed);
+
+    #if DEBUG_MESH_BACKEND
+        g_debug("MESH: probe() execute(%s)",buf);
+    #endif
+
+    Error rslt = gc_execute_line(buf, Uart0);
+    if (rslt != Error::Ok)
+    {
+        report_status_message(rslt, allClients);
+        g_error("MESH: probe() gc_execute_line failed");
+        return false;
+    }
+    *zResult = steps_to_mpos(probe_steps[Z_AXIS],Z_AXIS);
+    return true;
+}
+
+
+bool MeshFluidNC::probeTripped()
+{
+    return config->_probe->tripped();
+}
+
+
+void MeshFluidNC::pulloffFailed()
+{
+    rtAlarm = ExecAlarm::HomingFailPulloff;
+}
+
+
+bool MeshFluidNC::checkAbort()
+{
+    protocol_execute_realtime();
+    return sys.abort;
+}
+
+
+bool MeshFluidNC::setWorkZ(float z)
+{
+    char buf[80];
+    sprintf(buf,"g10 L20 z%5.3f",z);
+    return _mesh_execute(buf);
+}
+
+
+void MeshFluidNC::goIdle()
+{
+	Stepper::go_idle();         // Set steppers to the settings idle state before returning.
+	sys.state = State::Idle;    // Set to IDLE when complete.
+}
@@ -0,0 +1,66 @@
+//-------------------------------------------------
+// The machine underneath Mesh::doMeshLeveling()
+//-------------------------------------------------
+// The probing sequence only needs a handful of machine operations.
+// They are gathered here so that doMeshLeveling() can be run against
+// FluidNC (MeshFluidNC, the default) or against the synthetic-surface
+// simulator in extras/mesh_sim, which builds and runs on Linux.
+
+#pragma once
+
+
+class MeshBackend
+{
+    public:
+
+        virtual bool beginLeveling(float *mx, float *my) = 0;
+            // drain the planner and set up for probing, returning
+            // the current machine x,y position. false on abort.
+        virtual void endLeveling() = 0;
+            // done with the probing moves
+
+        virtual bool moveXY(float x, float y, float feed) = 0;
+        virtual bool moveZ(float z, float feed) = 0;
+        virtual bool rapidTo(float x, float y, float z) = 0;
+            // moves in machine coordinates (g53), which
+            // return when complete. false on abort.
+
+        virtual bool probe(float z, float feed, float *zResult) = 0;
+            // g38.2 towards z in the current coordinate system and
+            // return the machine z at which the probe tripped
+        virtual bool probeTripped() = 0;
+        virtual void pulloffFailed() = 0;
+            // raise the alarm for a probe that did not clear
+
+        virtual bool checkAbort() = 0;
+            // run the realtime protocol, true if the system is aborting
+
+        virtual bool setWorkZ(float z) = 0;
+            // g10 L20 - make the current position the given work z
+        virtual void goIdle() = 0;
+            // leave the steppers and system in the idle state
+};
+
+
+class MeshFluidNC : public MeshBackend
+{
+    public:
+
+        bool beginLeveling(float *mx, float *my) override;
+        void endLeveling() override;
+        bool moveXY(float x, float y, float feed) override;
+        bool moveZ(float z, float feed) override;
+        bool rapidTo(float x, float y, float z) override;
+        bool probe(float z, float feed, float *zResult) override;
+        bool probeTripped() override;
+        void pulloffFailed() override;
+        bool checkAbort() override;
+        bool setWorkZ(float z) override;
+        void goIdle() override;
+};
+
+
+extern MeshBackend *meshDefaultBackend();
+    // The backend the_mesh uses unless Mesh::setBackend() is called.
+    // MeshBackend.cpp returns the FluidNC one; the simulator links
+    // its own.
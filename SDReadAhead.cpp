@@ -0,0 +1,118 @@
+//-------------------------------------------------
+// A read-ahead ring for streaming SD jobs
+//-------------------------------------------------
+
+#include "SDReadAhead.h"
+
+#include <string.h>
+
+
+#if SD_READ_AHEAD
+    SDReadAhead g_sd_read_ahead;
+        // only when enabled, as it holds the whole ring
+#endif
+
+
+void SDReadAhead::begin(uint32_t file_size)
+{
+    m_state = RA_NONE;
+    m_file_size = file_size;
+
+    m_head = 0;
+    m_tail = 0;
+
+    m_filled = false;
+    m_starved = false;
+    m_low_water = SD_READ_AHEAD_SIZE;
+    m_lines = 0;
+    m_underruns = 0;
+
+    __atomic_store_n(&m_state,RA_BUSY,__ATOMIC_RELEASE);
+}
+
+
+uint8_t *SDReadAhead::writeSpace(uint32_t *len)
+{
+    uint32_t head = m_head;
+    uint32_t free = freeSpace();
+    uint32_t to_end = SD_READ_AHEAD_SIZE - head % SD_READ_AHEAD_SIZE;
+    *len = free < to_end ? free : to_end;
+    return &m_ring[head % SD_READ_AHEAD_SIZE];
+}
+
+
+void SDReadAhead::written(uint32_t len)
+{
+    __atomic_store_n(&m_head,m_head + len,__ATOMIC_RELEASE);
+}
+
+
+void SDReadAhead::endOfFile()
+{
+    int busy = RA_BUSY;
+    __atomic_compare_exchange_n(&m_state,&busy,RA_EOF,
+        false,__ATOMIC_RELEASE,__ATOMIC_RELAXED);
+}
+
+
+int SDReadAhead::read(uint8_t *buf, int size)
+{
+    // The state is loaded before the head, so that if it is
+    // RA_EOF, the head is the final one (endOfFile() follows
+    // the last written()).
+
+    int state = __atomic_load_n(&m_state,__ATOMIC_ACQUIRE);
+    uint32_t head = __atomic_load_n(&m_head,__ATOMIC_ACQUIRE);
+    uint32_t tail = m_tail;
+    if (state != RA_BUSY && state != RA_EOF)
+        return -1;
+
+    uint32_t used = head - tail;
+    if (!m_filled && (used == SD_READ_AHEAD_SIZE || state == RA_EOF))
+    {
+        m_filled = true;
+        m_low_water = used;
+    }
+    if (m_filled && state == RA_BUSY && used < m_low_water)
+        m_low_water = used;
+
+    if (!used)
+    {
+        if (state == RA_EOF)
+        {
+            int eof = RA_EOF;
+            __atomic_compare_exchange_n(&m_state,&eof,RA_DONE,
+                false,__ATOMIC_RELAXED,__ATOMIC_RELAXED);
+            return -1;
+        }
+        if (m_filled && !m_starved)
+        {
+            m_starved = true;
+            m_underruns++;
+        }
+        return 0;
+    }
+    m_starved = false;
+
+    int len = used < (uint32_t) size ? used : size;
+    uint32_t lines = 0;
+    for (int i=0; i<len; i++)
+    {
+        uint8_t c = m_ring[(tail + i) % SD_READ_AHEAD_SIZE];
+        lines += c == '\n';
+        buf[i] = c;
+    }
+    m_lines = m_lines + lines;
+    __atomic_store_n(&m_tail,tail + len,__ATOMIC_RELEASE);
+    return len;
+}
+
+
+void SDReadAhead::getStats(gReadAhead_t *stats)
+{
+    stats->size = SD_READ_AHEAD_SIZE;
+    stats->used = m_head - m_tail;
+    stats->low_water = m_filled ? m_low_water : 0;
+    stats->lines = m_lines;
+    stats->underruns = m_underruns;
+}
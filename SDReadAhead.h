@@ -0,0 +1,99 @@
+//-------------------------------------------------
+// A read-ahead ring for streaming SD jobs
+//-------------------------------------------------
+// FluidNC reads an SD job a character at a time, on demand, as each
+// line is finished, so a slow SD block read stalls the job, which on
+// files of many short segments can drain the planner.  Instead, a task
+// fills this ring from the file with large block reads, and FluidNC
+// reads the job from the ring, in RAM, so the card only has to keep
+// up on average.
+//
+// It is a single producer, single consumer ring, with no locks, and
+// is plain C++ so that it can be built on Linux.  gActions::startSDJob()
+// runs the reader task, and hands FluidNC a File that reads from the
+// ring, so that FluidNC still owns the job (the SDCard is Busy, and
+// errors, resets and the end of the file close it as before).
+// gStatus reports the occupancy and underruns.
+
+#pragma once
+
+#include <stdint.h>
+
+#ifndef SD_READ_AHEAD
+    #define SD_READ_AHEAD       0       // 1 to read SD jobs ahead
+#endif
+
+#ifndef SD_READ_AHEAD_SIZE
+    #define SD_READ_AHEAD_SIZE  8192    // bytes, a power of two
+#endif
+
+static_assert((SD_READ_AHEAD_SIZE & (SD_READ_AHEAD_SIZE - 1)) == 0,
+    "SD_READ_AHEAD_SIZE must be a power of two");
+
+
+typedef struct
+{
+    uint32_t size;          // of the ring
+    uint32_t used;          // bytes read ahead right now
+    uint32_t low_water;     // the least used since the first fill
+    uint32_t lines;         // read by FluidNC so far
+    uint32_t underruns;     // times FluidNC found it empty
+} gReadAhead_t;
+
+
+class SDReadAhead
+{
+    public:
+
+        SDReadAhead()   { begin(0); m_state = RA_NONE; }
+
+        void begin(uint32_t file_size);
+        void abort()            { __atomic_store_n(&m_state,RA_NONE,__ATOMIC_RELEASE); }
+        bool busy()             { int state = __atomic_load_n(&m_state,__ATOMIC_ACQUIRE);
+                                  return state == RA_BUSY || state == RA_EOF; }
+
+        // the reader task
+
+        uint8_t *writeSpace(uint32_t *len);
+            // the contiguous free space at the head, len is 0 if full
+        uint32_t freeSpace()    { return SD_READ_AHEAD_SIZE - (m_head - m_tail); }
+            // in all, which may wrap
+        void written(uint32_t len);
+        void endOfFile();
+            // after the last written()
+
+        // the consumer, FluidNC
+
+        int read(uint8_t *buf, int size);
+            // Copy up to size bytes into buf, returning the number copied.
+            // Returns 0 if there is nothing yet (and counts an underrun),
+            // or -1 when the whole file has been read, or it was aborted.
+
+        uint32_t fileSize()     { return m_file_size; }
+        uint32_t position()     { return m_tail; }
+            // bytes of the file read so far
+        void getStats(gReadAhead_t *stats);
+
+    private:
+
+        enum { RA_NONE, RA_BUSY, RA_EOF, RA_DONE };
+
+        volatile int m_state;
+        uint32_t m_file_size;
+
+        uint8_t m_ring[SD_READ_AHEAD_SIZE];
+        volatile uint32_t m_head;           // file offset, written by the reader
+        volatile uint32_t m_tail;           // file offset, written by the consumer
+
+        bool m_filled;                      // low_water is only kept after the first fill
+        bool m_starved;                     // counting each underrun once
+        volatile uint32_t m_low_water;
+        volatile uint32_t m_lines;
+        volatile uint32_t m_underruns;
+};
+
+
+#if SD_READ_AHEAD
+    extern SDReadAhead g_sd_read_ahead;
+        // the current SD job
+#endif
@@ -1,282 +1,782 @@
-// YamlOverrides.h
-//
-// By including this H file in the main machie INO file,
-// the ability to store Yaml Overrides (persistent runtime configuration)
-// is added to the program via overrides of WEAK_LINKs in FluidNC
-
-#pragma once
-
-#include <SPIFFS.h>
-#include "FluidDebug.h"
-#include <Machine/MachineConfig.h>	// FluidNC
-#include <Configuration/RuntimeSetting.h>	// FluidNC
-
-
-#define DEBUG_YAML_OVERRIDES    		2
-
-#define v_error g_debug
-	// until I figuire out a good way
-
-
-#define YAML_FILENAME   	"/yaml_tmp.txt"
-#define YAML_TEMPNAME   	"/yaml_tmp.tmp"
-#define MAX_YAML_LENGTH		128
-
-static char yaml_buf[MAX_YAML_LENGTH+1] = {0};
-
-
-static const char *getYamlLine(File &f)
-{
-	int len = 0;
-	int c = f.read();
-	yaml_buf[0] = 0;
-	while (c >= 0 && c != '\n' && len < MAX_YAML_LENGTH)
-	{
-		yaml_buf[len++] = c;
-		c = f.read();
-	}
-	if (len)
-	{
-		yaml_buf[len] = 0;
-		char *p = yaml_buf;
-		while (*p && *p != '=') p++;
-		if (*p == '=')
-		{
-			*p++ = 0;
-			#if DEBUG_YAML_OVERRIDES > 1
-				g_debug("getYamlLine(%s,%s)",yaml_buf,p);
-			#endif
-			return p;
-		}
-	}
-	#if DEBUG_YAML_OVERRIDES > 1
-		g_debug("getYamlLine returning NULL");
-	#endif
-	return NULL;
-}
-
-
-Error saveYamlOverride(const char *path, const char *value)
-	// Open the yaml.tmp file, see if the path is in it.
-	// If the path was not in the file, open for write (append) and add it.
-	// Otherwise, create a new temporary copy replaing the setting in the existin file and rename it.
-{
-	static bool in_override = false;
-
-	if (in_override)
-	{
-		v_error("saveYamlOverride(%s,%s) re-entered",path,value?value:"NULL");
-		return Error::AnotherInterfaceBusy;
-	}
-	in_override = true;
-
-	// First pass through file to see if path exists in it
-
-	#if DEBUG_YAML_OVERRIDES
-		g_debug("saveYamlOverride(%s,%s)",path,value?value:"NULL");
-	#endif
-
-	Error err = Error::Ok;
-	bool file_exists = false;
-	bool file_has_path = false;
-	if (SPIFFS.exists(YAML_FILENAME))
-	{
-		file_exists = true;
-		File f = SPIFFS.open(YAML_FILENAME);
-		if (f)
-		{
-			while (getYamlLine(f))
-			{
-				if (!strcmp(path,yaml_buf))
-				{
-					file_has_path = true;
-					#if DEBUG_YAML_OVERRIDES > 1
-						g_debug("saveYamlOverride() file_has_path");
-					#endif
-					break;
-				}
-			}
-			f.close();
-		}
-		else
-		{
-			v_error("saveYamlOverride() could not open SPIFFS %s for reading",YAML_FILENAME);
-			err = Error::FsFailedOpenFile;
-		}
-
-	}
-	else
-	{
-		#if DEBUG_YAML_OVERRIDES > 1
-			g_debug("saveYamlOverride() %s does not exist",YAML_FILENAME);
-		#endif
-	}
-
-	// 2nd pass append to existing file or copy/rename
-
-	if (err==Error::Ok && !file_exists || !file_has_path)		// just append to existing file
-	{
-		File f = SPIFFS.open(YAML_FILENAME,FILE_APPEND);
-		if (f)
-		{
-			f.print(path);
-			f.print("=");
-			f.print(value);
-			f.print('\n');
-			f.close();
-			#if DEBUG_YAML_OVERRIDES > 1
-				g_debug("saveYamlOverride() appended %s=%s to %s",path,value,YAML_FILENAME);
-			#endif
-		}
-		else
-		{
-			v_error("saveYamlOverride() could not open SPIFFS %s for writing",YAML_FILENAME);
-			err = Error::FsFailedOpenFile;
-		}
-	}
-	else if (err==Error::Ok)		// copy from old file to new file then rename
-	{
-		#if DEBUG_YAML_OVERRIDES > 1
-			g_debug("saveYamlOverride() creating %s from %s",YAML_TEMPNAME,YAML_FILENAME);
-		#endif
-
-		File fi = SPIFFS.open(YAML_FILENAME);
-		if (!fi)
-		{
-			v_error("saveYamlOverride() could not open SPIFFS %s for reading",YAML_FILENAME);
-			err = Error::FsFailedOpenFile;
-		}
-		else
-		{
-			File fo = SPIFFS.open(YAML_TEMPNAME,FILE_WRITE);
-			if (!fo)
-			{
-				fi.close();
-				v_error("saveYamlOverride() could not open SPIFFS %s for writing",YAML_TEMPNAME);
-				err = Error::FsFailedOpenFile;
-			}
-			else
-			{
-				const char *yaml_value;
-				while (yaml_value = getYamlLine(fi))
-				{
-					if (!strcmp(path,yaml_buf))
-					{
-						#if DEBUG_YAML_OVERRIDES > 1
-							g_debug("saveYamlOverride() replaced %s=%s",path,value);
-						#endif
-						if (fo.print(path) != strlen(path) ||
-							fo.print("=") != 1 ||
-							fo.print(value) != strlen(value))
-						{
-							v_error("saveYamlOverride() could not write yaml_override %s=%s",path,value);
-							err = Error:: NvsSetFailed;
-							break;
-						}
-					}
-					else
-					{
-						if (fo.print(yaml_buf) != strlen(yaml_buf) ||
-							fo.print("=") != 1 ||
-							fo.print(yaml_value) != strlen(yaml_value))
-						{
-							v_error("saveYamlOverride() could not write existing yaml_override %s=%s",yaml_buf,yaml_value);
-							err = Error:: NvsSetFailed;
-							break;
-						}
-					}
-					fo.print('\n');
-				}
-
-				fo.close();
-				fi.close();
-
-				if (err==Error::Ok)
-				{
-					if (!SPIFFS.remove(YAML_FILENAME))
-					{
-						v_error("saveYamlOverride() could not remove %s",YAML_FILENAME);
-						err = Error::NvsSetFailed;
-					}
-					else if (!SPIFFS.rename(YAML_TEMPNAME,YAML_FILENAME))
-					{
-						v_error("saveYamlOverride() could not renane %s to %s",YAML_TEMPNAME,YAML_FILENAME);
-						err = Error::NvsSetFailed;
-					}
-
-				}	// no error copying from one to the other
-			}	// no error opening fo
-		}	// no error opening fi
-	}	// no error on 1st read pass
-
-	#if DEBUG_YAML_OVERRIDES > 1
-		g_debug("saveYamlOverride() returning %d",err);
-	#endif
-
-	in_override = false;
-	return err;
-}
-
-
-void loadYamlOverrides()
-{
-	#if DEBUG_YAML_OVERRIDES
-		g_debug("loadYamlOverrides()");
-	#endif
-	if (SPIFFS.exists(YAML_FILENAME))
-	{
-		File f = SPIFFS.open(YAML_FILENAME);
-		if (f)
-		{
-			const char *yaml_value;
-			while (yaml_value = getYamlLine(f))
-			{
-				Configuration::RuntimeSetting rts(yaml_buf, yaml_value, allClients);
-				config->group(rts);
-
-				// the runtime setting already set the value into the tree,
-				// so validating it at this point is a bit anachrynous.
-				// what about if it is a non-existent key (i.e. gone out of date)
-				// or if it changed types?
-
-				if (!rts.isHandled_)
-				{
-					v_error("YamlOverride(%s,%s) not handled!",yaml_buf,yaml_value);
-				}
-
-				// 	try
-				// 	{
-				// 		Configuration::Validator validator;
-				// 		config->validate();
-				// 		config->group(validator);
-				// 	}
-				// 	catch (std::exception& ex)
-				// 	{
-				// 		log_error("Validation error: " << ex.what() << " at line(" << line_num << "): " << yaml_buf << "=" << yaml_value << " in " << YAML_FILENAME);
-				// 	}
-			}
-
-			f.close();
-		}
-		else
-		{
-			v_error("ERROR could not open SPIFFS %s for reading",YAML_FILENAME);
-		}
-	}
-	else
-	{
-		#if DEBUG_YAML_OVERRIDES > 1
-			g_debug("loadYamlOverrides() %s does not exist",YAML_FILENAME);
-		#endif
-	}
-}
-
-
-void clearYamlOverrides()
-{
-	#if DEBUG_YAML_OVERRIDES
-		g_debug("clearYamlOverrides()");
-	#endif
-	SPIFFS.remove(YAML_FILENAME);
-	SPIFFS.remove(YAML_TEMPNAME);
-}
+// YamlOverrides.h
+//
+// By including this H file in the main machie INO file,
+// the ability to store Yaml Overrides (persistent runtime configuration)
+// is added to the program via overrides of WEAK_LINKs in FluidNC
+//
+// The overrides are read from the SPIFFS once, into an in memory index
+// hashed by path, so that saveYamlOverride() only updates memory.
+//
+// The file is an append-only journal of seq,crc:path=value records.
+// A background task appends the records that changed since it last ran,
+// and the journal is replayed, last write wins, at boot.  Bad lines are
+// skipped, so one corrupt record only loses itself.  When it grows past
+// YAML_COMPACT_SIZE it is compacted, through a temp file, to one record
+// per path, unless it holds more paths than MAX_YAML_OVERRIDES, when the
+// ones that did not fit are reported, and kept, by only appending.  Lines without a crc, or sequence number (from older versions,
+// or edited by hand) are accepted, in order.
+//
+// Changes from any task are queued to a single worker task, which owns
+// the index and the file, and the caller waits for its result.
+//
+// Changes are coalesced, and only written after YAML_QUIET_MS with no
+// further changes (or YAML_MAX_WAIT_MS after the first one), and never
+// while the machine is moving, as flash writes can disturb step timing,
+// or in the middle of a gActions::beginSettings() transaction.
+
+#pragma once
+
+#include <SPIFFS.h>
+#include "FluidDebug.h"
+#include "BufferedReader.h"
+#include "gStatus.h"
+#include "gActions.h"
+#include <Machine/MachineConfig.h>	// FluidNC
+#include <Configuration/RuntimeSetting.h>	// FluidNC
+
+
+#define DEBUG_YAML_OVERRIDES    		2
+
+#define v_error g_debug
+	// until I figuire out a good way
+
+
+#define YAML_FILENAME   	"/yaml_tmp.txt"
+#define YAML_TEMPNAME   	"/yaml_tmp.tmp"
+#define MAX_YAML_LENGTH		128		// the longest journal line that can be read back
+#define YAML_RECORD_EXTRA	18		// up to 10 digits, comma, crc, colon, equals, and newline
+
+#define MAX_YAML_OVERRIDES	256
+#define YAML_HASH_SIZE		512		// power of two, at least MAX_YAML_OVERRIDES * 4/3
+#define YAML_POLL_MS		100		// how often the worker checks for changes to write
+#define YAML_QUEUE_LEN		8		// requests waiting for the worker
+
+#ifndef YAML_QUIET_MS
+	#define YAML_QUIET_MS		500		// write after this long without a change
+#endif
+#ifndef YAML_MAX_WAIT_MS
+	#define YAML_MAX_WAIT_MS	5000	// or this long after the first change
+#endif
+#define YAML_COMPACT_SIZE	4096	// compact the journal when it is bigger than this
+									// and more than twice the size of the live records
+
+typedef struct
+{
+	uint32_t hash;
+	uint32_t seq;	// of the last change
+	char *path;		// malloc'd
+	char *value;	// malloc'd
+} yamlEntry_t;
+
+static yamlEntry_t yaml_entries[MAX_YAML_OVERRIDES];
+	// in the order they were first saved
+static int16_t yaml_hash[YAML_HASH_SIZE];
+	// index into yaml_entries, or -1
+static int yaml_count = 0;
+static bool yaml_indexed = false;
+static volatile bool yaml_dirty = false;
+static volatile uint32_t yaml_first_change = 0;
+static volatile uint32_t yaml_last_change = 0;
+	// millis() of the changes since the last flush
+static bool yaml_compact = false;
+	// the journal needs to be rewritten
+static bool yaml_overflow = false;
+	// the journal has more paths than the index, so it must not be compacted
+static uint32_t yaml_seq = 0;
+	// of the last change
+static uint32_t yaml_flushed_seq = 0;
+	// of the last change in the journal
+static size_t yaml_journal_size = 0;
+
+
+typedef struct
+{
+	const char *path;		// NULL to clear all the overrides
+	const char *value;
+	Error result;
+	SemaphoreHandle_t done;
+} yamlRequest_t;
+	// on the stack of the caller, who waits for done
+
+static QueueHandle_t yaml_queue = NULL;
+	// of yamlRequest_t pointers
+static TaskHandle_t yaml_task = NULL;
+
+
+static uint16_t yamlCrc(uint32_t seq, const char *path, int len)
+	// CRC-16/CCITT of a record's sequence number and len
+	// bytes of its "path=value" (or just the path)
+{
+	uint8_t seq_bytes[4] = {
+		(uint8_t) seq, (uint8_t) (seq >> 8), (uint8_t) (seq >> 16), (uint8_t) (seq >> 24) };
+	uint16_t crc = 0xffff;
+	for (int i=0; i<4 + len; i++)
+	{
+		crc ^= (i < 4 ? seq_bytes[i] : (uint8_t) path[i-4]) << 8;
+		for (int bit=0; bit<8; bit++)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+
+static int yamlRecord(char *buf, uint32_t seq, const char *path, const char *value)
+	// format a journal record into buf, returning its length
+{
+	int len = sprintf(buf,"%u,0000:%s=%s\n",(unsigned) seq,path,value);
+	char *rec = strchr(buf,':') + 1;
+	char crc[5];
+	sprintf(crc,"%04x",yamlCrc(seq,rec,len - (rec - buf) - 1));
+	memcpy(rec - 5,crc,4);
+	return len;
+}
+
+
+static int getYamlLine(BufferedReader &reader, char *yaml_buf, const char **value, uint32_t *seq)
+	// Returns 1 for a record, with the path left in yaml_buf, the value
+	// in value, and the sequence number, or 0 if there isn't one, in seq.
+	// Returns 0 for a line that is not a good record, which the caller
+	// skips, and -1 at the end of the file.  Lines longer than
+	// MAX_YAML_LENGTH are truncated (and so fail their crc).  A journal
+	// record without its terminating newline was torn by a reset during
+	// the append, and one that fails its crc was corrupted, or merged
+	// with the next by a failed append, so they are discarded.
+{
+	int delim;
+	int len = reader.readToken(yaml_buf,MAX_YAML_LENGTH,"\n",&delim);
+	if (len < 0)
+		return -1;
+
+	char *path = yaml_buf;
+	uint32_t num = 0;
+	while (*path >= '0' && *path <= '9')
+		num = num * 10 + *path++ - '0';
+
+	int crc = -1;
+	unsigned hex;
+	int n = 0;
+	if (path != yaml_buf && sscanf(path,",%4x:%n",&hex,&n) == 1 && n == 6)
+	{
+		crc = hex;
+		path += 5;
+	}
+
+	*seq = 0;
+	if (*path == ':' && path != yaml_buf)
+	{
+		*seq = num;
+		path++;
+	}
+	else
+		path = yaml_buf;
+
+	char *p = path;
+	while (*p && *p != '=') p++;
+
+	const char *bad = NULL;
+	if (*p != '=' || p == path)
+		bad = "bad line";
+	else if (*seq && delim != '\n')
+		bad = "torn record";
+	else if (crc >= 0 && crc != yamlCrc(*seq,path,strlen(path)))
+		bad = "corrupt record";
+	if (bad)
+	{
+		if (len)
+			v_error("getYamlLine() discarding %s %s",bad,yaml_buf);
+		yaml_compact = true;
+		return 0;
+	}
+
+	*p++ = 0;
+	if (path != yaml_buf)
+		memmove(yaml_buf,path,strlen(path)+1);
+	*value = p;
+	#if DEBUG_YAML_OVERRIDES > 1
+		g_debug("getYamlLine(%u:%s,%s)",(unsigned) *seq,yaml_buf,*value);
+	#endif
+	return 1;
+}
+
+
+static void yamlChanged()
+	// mark the index as needing to be written
+{
+	uint32_t now = millis();
+	if (!yaml_dirty)
+		yaml_first_change = now;
+	yaml_last_change = now;
+	yaml_dirty = true;
+}
+
+
+//------------------------------------------
+// the in-memory index
+//------------------------------------------
+// Only used by the worker task, or at boot before it is started.
+
+
+static uint32_t yamlHash(const char *path)
+	// FNV-1a, case insensitive like RuntimeSetting
+{
+	uint32_t hash = 2166136261UL;
+	while (*path)
+	{
+		hash ^= (uint8_t) tolower(*path++);
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+
+static int yamlFind(const char *path, uint32_t hash, int *slot)
+	// return the entry number for the path, or -1,
+	// setting slot to the hash slot it is in, or would go in.
+{
+	int i = hash & (YAML_HASH_SIZE-1);
+	while (yaml_hash[i] >= 0)
+	{
+		yamlEntry_t *entry = &yaml_entries[yaml_hash[i]];
+		if (entry->hash == hash && !strcasecmp(entry->path,path))
+		{
+			*slot = i;
+			return yaml_hash[i];
+		}
+		i = (i + 1) & (YAML_HASH_SIZE-1);
+	}
+	*slot = i;
+	return -1;
+}
+
+
+static int yamlSet(const char *path, const char *value, uint32_t seq)
+	// add or replace the value for the path, unless it was
+	// set by a later sequence number.
+	// returns 1 if it changed, 0 if it did not, and -1 on an error
+{
+	if (*path == '/')
+		path++;
+	int slot;
+	uint32_t hash = yamlHash(path);
+	int num = yamlFind(path,hash,&slot);
+
+	if (num >= 0)
+	{
+		yamlEntry_t *entry = &yaml_entries[num];
+		if (seq < entry->seq || !strcmp(entry->value,value))
+			return 0;
+		char *new_value = strdup(value);
+		if (!new_value)
+			return -1;
+		free(entry->value);
+		entry->value = new_value;
+		entry->seq = seq;
+		return 1;
+	}
+
+	if (yaml_count >= MAX_YAML_OVERRIDES)
+	{
+		v_error("YamlOverrides full (%d) at %s",MAX_YAML_OVERRIDES,path);
+		return -1;
+	}
+
+	yamlEntry_t *entry = &yaml_entries[yaml_count];
+	entry->hash = hash;
+	entry->seq = seq;
+	entry->path = strdup(path);
+	entry->value = strdup(value);
+	if (!entry->path || !entry->value)
+	{
+		free(entry->path);
+		free(entry->value);
+		entry->path = entry->value = NULL;
+		return -1;
+	}
+	yaml_hash[slot] = yaml_count++;
+	return 1;
+}
+
+
+static void yamlClearIndex()
+{
+	for (int i=0; i<yaml_count; i++)
+	{
+		free(yaml_entries[i].path);
+		free(yaml_entries[i].value);
+		yaml_entries[i].path = yaml_entries[i].value = NULL;
+	}
+	yaml_count = 0;
+	memset(yaml_hash,0xff,sizeof(yaml_hash));
+}
+
+
+static void yamlReadIndex()
+	// replay the journal into the index, once.
+	// Uses the temp file if a compaction was interrupted before the rename.
+{
+	if (yaml_indexed)
+		return;
+	yaml_indexed = true;
+	yamlClearIndex();
+	yaml_seq = 0;
+	yaml_journal_size = 0;
+
+	const char *filename = YAML_FILENAME;
+	if (!SPIFFS.exists(filename))
+	{
+		filename = YAML_TEMPNAME;
+		if (!SPIFFS.exists(filename))
+		{
+			#if DEBUG_YAML_OVERRIDES > 1
+				g_debug("yamlReadIndex() %s does not exist",YAML_FILENAME);
+			#endif
+			return;
+		}
+		yaml_compact = true;
+	}
+
+	File f = SPIFFS.open(filename);
+	if (!f)
+	{
+		v_error("ERROR could not open SPIFFS %s for reading",filename);
+		return;
+	}
+
+	int records = 0;
+	int skipped = 0;
+	int lost = 0;
+	yaml_journal_size = f.size();
+	BufferedReader reader(f);
+	char yaml_buf[MAX_YAML_LENGTH+1];
+	const char *yaml_value;
+	uint32_t seq;
+	int rslt;
+	while ((rslt = getYamlLine(reader,yaml_buf,&yaml_value,&seq)) >= 0)
+	{
+		if (!rslt)
+		{
+			skipped++;
+			continue;
+		}
+		records++;
+		if (seq)
+		{
+			if (seq > yaml_seq)
+				yaml_seq = seq;
+		}
+		else
+		{
+			seq = ++yaml_seq;
+			yaml_compact = true;
+		}
+		if (yamlSet(yaml_buf,yaml_value,seq) < 0)
+			lost++;
+	}
+	f.close();
+
+	// Records that could not be indexed are not applied, but are
+	// left in the journal, which is only appended to from now on.
+
+	if (lost)
+	{
+		g_error("YamlOverrides could not index %d of the %d records in %s (max %d paths)",
+			lost,records,filename,MAX_YAML_OVERRIDES);
+		yaml_overflow = true;
+		yaml_compact = false;
+	}
+
+	yaml_flushed_seq = yaml_seq;
+	if (yaml_compact)
+		yamlChanged();
+
+	#if DEBUG_YAML_OVERRIDES
+		g_debug("yamlReadIndex() read %d overrides in %d records from %s, skipped %d lines",yaml_count,records,filename,skipped);
+	#endif
+}
+
+
+//------------------------------------------
+// background flush
+//------------------------------------------
+
+static bool yamlFlush()
+	// Serialize the records that changed since the last flush, or all
+	// of them if compacting, to memory, then append them to the journal,
+	// or write the temp file and rename it over the journal.
+{
+	yaml_dirty = false;
+
+	size_t live_size = 0;
+	size_t size = 0;
+	for (int i=0; i<yaml_count; i++)
+	{
+		yamlEntry_t *entry = &yaml_entries[i];
+		size_t len = strlen(entry->path) + strlen(entry->value) + YAML_RECORD_EXTRA;
+		live_size += len;
+		if (entry->seq > yaml_flushed_seq)
+			size += len;
+	}
+
+	bool compact = !yaml_overflow && (yaml_compact || (
+		yaml_journal_size + size > YAML_COMPACT_SIZE &&
+		yaml_journal_size + size > 2 * live_size));
+	if (compact)
+		size = live_size;
+
+	char *buf = (char *) malloc(size + 1);
+	if (!buf)
+	{
+		v_error("yamlFlush() could not allocate %d bytes",size);
+		yamlChanged();
+		return false;
+	}
+
+	char *p = buf;
+	for (int i=0; i<yaml_count; i++)
+	{
+		yamlEntry_t *entry = &yaml_entries[i];
+		if (compact || entry->seq > yaml_flushed_seq)
+			p += yamlRecord(p,entry->seq,entry->path,entry->value);
+	}
+	size = p - buf;
+
+	#if DEBUG_YAML_OVERRIDES > 1
+		g_debug("yamlFlush() %s %d bytes",compact?"compacting to":"appending",size);
+	#endif
+
+	bool ok = false;
+	const char *filename = compact ? YAML_TEMPNAME : YAML_FILENAME;
+	File f = SPIFFS.open(filename,compact ? FILE_WRITE : FILE_APPEND);
+	if (!f)
+	{
+		v_error("yamlFlush() could not open SPIFFS %s for writing",filename);
+	}
+	else
+	{
+		ok = f.write((const uint8_t *) buf,size) == size;
+		f.close();
+		if (!ok)
+			v_error("yamlFlush() could not write %s",filename);
+		else if (!compact)
+			;
+		else if (SPIFFS.exists(YAML_FILENAME) && !SPIFFS.remove(YAML_FILENAME))
+		{
+			v_error("yamlFlush() could not remove %s",YAML_FILENAME);
+			ok = false;
+		}
+		else if (!SPIFFS.rename(YAML_TEMPNAME,YAML_FILENAME))
+		{
+			v_error("yamlFlush() could not rename %s to %s",YAML_TEMPNAME,YAML_FILENAME);
+			ok = false;
+		}
+	}
+
+	free(buf);
+	if (ok)
+	{
+		yaml_flushed_seq = yaml_seq;
+		yaml_journal_size = compact ? size : yaml_journal_size + size;
+		if (compact)
+			yaml_compact = false;
+	}
+	else
+	{
+		// a failed append may have left a partial record
+
+		yaml_compact = true;
+		yamlChanged();		// try again after another quiet period
+	}
+	return ok;
+}
+
+
+static bool yamlFlushReady()
+{
+	if (gActions::inSettings())
+		return false;		// hold off until commitSettings()
+	switch (g_status.getJobState())
+	{
+		case JOB_BUSY :
+		case JOB_HOMING :
+		case JOB_PROBING :
+		case JOB_MESHING :
+			return false;
+		default :
+			break;
+	}
+	uint32_t now = millis();
+	return now - yaml_last_change >= YAML_QUIET_MS ||
+		   now - yaml_first_change >= YAML_MAX_WAIT_MS;
+}
+
+
+//------------------------------------------
+// the worker task
+//------------------------------------------
+
+static Error yamlDoRequest(yamlRequest_t *request)
+{
+	yamlReadIndex();
+
+	if (!request->path)		// clear
+	{
+		yamlClearIndex();
+		yaml_dirty = false;
+		yaml_compact = false;
+		yaml_overflow = false;
+		yaml_flushed_seq = yaml_seq;
+		yaml_journal_size = 0;
+		SPIFFS.remove(YAML_FILENAME);
+		SPIFFS.remove(YAML_TEMPNAME);
+		return Error::Ok;
+	}
+
+	// a record that getYamlLine() would truncate would be
+	// discarded as corrupt, and so lost, at the next boot
+
+	const char *path = request->path;
+	const char *value = request->value ? request->value : "";
+	if (*path == '/')
+		path++;
+	if (strlen(path) + strlen(value) + YAML_RECORD_EXTRA > MAX_YAML_LENGTH + 1)
+	{
+		g_error("YamlOverride %s=%s is too long to save",path,value);
+		return Error::Overflow;
+	}
+
+	int rslt = yamlSet(path,value,yaml_seq+1);
+	if (rslt > 0)
+	{
+		yaml_seq++;
+		yamlChanged();
+	}
+	return rslt < 0 ? Error::NvsSetFailed : Error::Ok;
+}
+
+
+static void yamlTask(void *param)
+	// Applies the requests in the order they were queued,
+	// and writes the changes when it is time to.
+{
+	while (1)
+	{
+		yamlRequest_t *request;
+		if (xQueueReceive(yaml_queue,&request,YAML_POLL_MS / portTICK_PERIOD_MS) == pdTRUE)
+		{
+			request->result = yamlDoRequest(request);
+			xSemaphoreGive(request->done);
+		}
+		if (yaml_dirty && yamlFlushReady())
+			yamlFlush();
+	}
+}
+
+
+static void yamlInit()
+	// Create the queue and start the worker.  Called from
+	// loadYamlOverrides() at boot, before anything else can
+	// save an override.
+{
+	if (!yaml_queue)
+	{
+		yaml_queue = xQueueCreate(YAML_QUEUE_LEN,sizeof(yamlRequest_t *));
+		xTaskCreate(yamlTask,"yamlOverrides",4096,NULL,1,&yaml_task);
+	}
+}
+
+
+static Error yamlRequest(const char *path, const char *value)
+	// queue a request and wait for the worker to do it
+{
+	yamlInit();
+
+	StaticSemaphore_t done_buf;
+	yamlRequest_t request;
+	request.path = path;
+	request.value = value;
+	request.result = Error::Ok;
+	request.done = xSemaphoreCreateBinaryStatic(&done_buf);
+
+	yamlRequest_t *ptr = &request;
+	xQueueSend(yaml_queue,&ptr,portMAX_DELAY);
+	xSemaphoreTake(request.done,portMAX_DELAY);
+	vSemaphoreDelete(request.done);
+	return request.result;
+}
+
+
+//------------------------------------------
+// bulk application at boot
+//------------------------------------------
+
+class YamlBulkSetting : public Configuration::RuntimeSetting
+	// Applies all of the overrides in one traversal of the configuration
+	// tree, instead of one traversal per override, by tracking the path
+	// through the sections and looking each item up in the index.  Each
+	// match is parsed by a RuntimeSetting for just that item.
+	//
+	// Derived from RuntimeSetting because group() methods (i.e. the Mesh)
+	// cast Runtime handlers to one.  is() never matches, so they do not
+	// run commands or act on changes, which there is nothing to act on
+	// at boot.
+{
+	public:
+
+		YamlBulkSetting() :
+			RuntimeSetting("",NULL,allClients),
+			m_len(0)
+		{
+			m_path[0] = 0;
+			memset(m_applied,0,sizeof(m_applied));
+		}
+
+		bool applied(int num)  { return m_applied[num]; }
+
+		void item(const char* name, bool& value) override
+			{ apply(name,value); }
+		void item(const char* name, int32_t& value, int32_t minValue, int32_t maxValue) override
+			{ apply(name,value,minValue,maxValue); }
+		void item(const char* name, float& value, float minValue, float maxValue) override
+			{ apply(name,value,minValue,maxValue); }
+		void item(const char* name, std::vector<speedEntry>& value) override
+			{ apply(name,value); }
+		void item(const char* name, UartData& wordLength, UartParity& parity, UartStop& stopBits) override
+			{ apply(name,wordLength,parity,stopBits); }
+		void item(const char* name, Pin& value) override
+			{ apply(name,value); }
+		void item(const char* name, IPAddress& value) override
+			{ apply(name,value); }
+		void item(const char* name, int& value, EnumItem* e) override
+			{ apply(name,value,e); }
+		void item(const char* name, String& value, int minLength, int maxLength) override
+			{ apply(name,value,minLength,maxLength); }
+
+	protected:
+
+		void enterSection(const char* name, Configuration::Configurable* value) override
+		{
+			int len = m_len;
+			if (push(name))
+				value->group(*this);
+			m_len = len;
+			m_path[len] = 0;
+		}
+
+		bool matchesUninitialized(const char* name) override { return false; }
+
+	private:
+
+		char m_path[MAX_YAML_LENGTH+1];
+		int m_len;
+		bool m_applied[MAX_YAML_OVERRIDES];
+
+		bool push(const char *name)
+			// add a name to the path, false if it will not fit
+		{
+			int len = strlen(name);
+			if (m_len + len + 1 > MAX_YAML_LENGTH)
+				return false;
+			if (m_len)
+				m_path[m_len++] = '/';
+			strcpy(&m_path[m_len],name);
+			m_len += len;
+			return true;
+		}
+
+		template <typename... Args>
+		void apply(const char *name, Args&&... args)
+		{
+			int len = m_len;
+			int slot;
+			int num = push(name) ? yamlFind(m_path,yamlHash(m_path),&slot) : -1;
+			if (num >= 0)
+			{
+				#if DEBUG_YAML_OVERRIDES > 1
+					g_debug("YamlBulkSetting(%s,%s)",m_path,yaml_entries[num].value);
+				#endif
+				Configuration::RuntimeSetting rts(name, yaml_entries[num].value, allClients);
+				rts.item(name, std::forward<Args>(args)...);
+				m_applied[num] = rts.isHandled_;
+			}
+			m_len = len;
+			m_path[len] = 0;
+		}
+};
+
+
+//------------------------------------------
+// WEAK_LINK overrides
+//------------------------------------------
+
+Error saveYamlOverride(const char *path, const char *value)
+	// Update the path in the in memory index.
+	// The worker task will write it to the SPIFFS.
+	// May be called from any task.
+{
+	#if DEBUG_YAML_OVERRIDES
+		g_debug("saveYamlOverride(%s,%s)",path,value?value:"NULL");
+	#endif
+
+	Error err = yamlRequest(path,value);
+
+	#if DEBUG_YAML_OVERRIDES > 1
+		g_debug("saveYamlOverride() returning %d",err);
+	#endif
+
+	return err;
+}
+
+
+void loadYamlOverrides()
+{
+	#if DEBUG_YAML_OVERRIDES
+		g_debug("loadYamlOverrides()");
+	#endif
+
+	yamlReadIndex();
+
+	YamlBulkSetting bulk;
+	config->group(bulk);
+
+	// the settings are already in the tree, so validating
+	// them at this point is a bit anachrynous.  Overrides that
+	// did not match an item have gone out of date, or were
+	// not settings in the first place.
+
+	int unmatched = 0;
+	for (int i=0; i<yaml_count; i++)
+	{
+		if (!bulk.applied(i))
+		{
+			v_error("YamlOverride(%s,%s) not handled!",yaml_entries[i].path,yaml_entries[i].value);
+			unmatched++;
+		}
+	}
+
+	#if DEBUG_YAML_OVERRIDES
+		g_debug("loadYamlOverrides() applied %d of %d overrides",yaml_count-unmatched,yaml_count);
+	#endif
+
+	// 	try
+	// 	{
+	// 		Configuration::Validator validator;
+	// 		config->validate();
+	// 		config->group(validator);
+	// 	}
+	// 	catch (std::exception& ex)
+	// 	{
+	// 		log_error("Validation error: " << ex.what() << " in " << YAML_FILENAME);
+	// 	}
+
+	yamlInit();
+}
+
+
+void clearYamlOverrides()
+{
+	#if DEBUG_YAML_OVERRIDES
+		g_debug("clearYamlOverrides()");
+	#endif
+
+	yamlRequest(NULL,NULL);
+}
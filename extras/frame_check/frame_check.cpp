@@ -0,0 +1,177 @@
+//-------------------------------------------------
+// frame_check - round trip status frames on Linux
+//-------------------------------------------------
+// Build from the library directory:
+//
+//   g++ -std=gnu++17 -O2 -I. -Iextras/frame_check/stubs -Iextras/mesh_sim/stubs
+//       -o frame_check extras/frame_check/*.cpp gStatusFrame.cpp
+//
+// Usage:
+//
+//   frame_check [-n frames] [-s seed]
+//
+// Encodes a random walk of frames (default 1000), a full frame every
+// 100 with deltas in between, as a client of gStatus would, and checks
+// that each one decodes to the frame that was encoded, and that every
+// truncation of it is rejected.  The walk includes steps, z values and
+// times that jump across the whole of their ranges, for the zigzag
+// varints.  Prints the average frame size, and exits with 1 on the
+// first failure.
+
+#include "gStatus.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define FULL_EVERY  100
+
+
+static void usage()
+{
+    fprintf(stderr,"usage: frame_check [-n frames] [-s seed]\n");
+    exit(1);
+}
+
+
+static int32_t randomInt(int32_t range)
+    // -range..range, or anything if range is 0
+{
+    uint32_t r = ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+    if (!range)
+        return (int32_t) r;
+    return (int32_t) (r % (2 * (uint32_t) range + 1)) - range;
+}
+
+
+static bool chance(int percent)
+{
+    return rand() % 100 < percent;
+}
+
+
+static void nextFrame(gStatusFrame_t *frame)
+    // move the frame on, as a job would, with the odd wild jump
+{
+    frame->ms += chance(1) ? randomInt(0) : 10 + rand() % 200;
+    if (chance(5))  frame->job_state = rand() % (JOB_ALARM + 1);
+    if (chance(5))  frame->sys_state = rand() % 9;
+    if (chance(2))  frame->sd_state = rand() % 5;
+    if (chance(1))  frame->alarm = rand() % 256;
+    if (chance(1))  frame->wifi_state = rand() % 16;
+    if (chance(2))  frame->feed_override = 10 + rand() % 191;
+    if (chance(2))  frame->rapid_override = rand() % 2 ? 25 : 100;
+    if (chance(2))  frame->spindle_override = 10 + rand() % 191;
+    if (chance(30)) frame->file_pct += rand() % 20;
+    for (int i=0; i<G_NUM_AXIS; i++)
+    {
+        if (chance(70))
+            frame->steps[i] = (uint32_t) frame->steps[i] + (chance(1) ? randomInt(0) : randomInt(2000));
+    }
+    if (chance(20)) frame->live_z = chance(5) ? randomInt(0) : randomInt(500);
+    if (chance(20)) frame->mesh_z = chance(5) ? randomInt(0) : frame->mesh_z + randomInt(50);
+}
+
+
+static bool sameFrame(const gStatusFrame_t *a, const gStatusFrame_t *b)
+{
+    return
+        a->seq == b->seq &&
+        a->ms == b->ms &&
+        a->job_state == b->job_state &&
+        a->sys_state == b->sys_state &&
+        a->sd_state == b->sd_state &&
+        a->alarm == b->alarm &&
+        a->wifi_state == b->wifi_state &&
+        a->feed_override == b->feed_override &&
+        a->rapid_override == b->rapid_override &&
+        a->spindle_override == b->spindle_override &&
+        a->file_pct == b->file_pct &&
+        !memcmp(a->steps,b->steps,sizeof(a->steps)) &&
+        a->live_z == b->live_z &&
+        a->mesh_z == b->mesh_z;
+}
+
+
+static int fail(int n, const char *what)
+{
+    printf("FAILED at frame %d: %s\n",n,what);
+    return 1;
+}
+
+
+int main(int argc, char **argv)
+{
+    int num_frames = 1000;
+    int seed = 1;
+
+    for (int i=1; i<argc; i++)
+    {
+        if (!strcmp(argv[i],"-n") && i+1 < argc)
+            num_frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i],"-s") && i+1 < argc)
+            seed = atoi(argv[++i]);
+        else
+            usage();
+    }
+    srand(seed);
+
+    gStatusFrame_t frame;
+    gStatusFrame_t prev;
+    gStatusFrame_t decoded;
+    gStatusFrame_t scratch;
+    memset(&frame,0,sizeof(frame));
+    memset(&decoded,0,sizeof(decoded));
+    frame.feed_override = 100;
+    frame.rapid_override = 100;
+    frame.spindle_override = 100;
+
+    uint8_t buf[G_FRAME_MAX];
+    if (gStatus::encodeFrame(buf,G_FRAME_MAX-1,&frame))
+        return fail(0,"encoded into a buffer smaller than G_FRAME_MAX");
+
+    long total = 0;
+    int num_full = 0;
+    int max_len = 0;
+    for (int n=0; n<num_frames; n++)
+    {
+        nextFrame(&frame);
+        bool full = n % FULL_EVERY == 0;
+        int len = gStatus::encodeFrame(buf,sizeof(buf),&frame,full ? NULL : &prev);
+
+        if (len <= 0 || len > G_FRAME_MAX)
+            return fail(n,"bad length");
+        if (full && len != G_FRAME_FULL_SIZE)
+            return fail(n,"full frame is not G_FRAME_FULL_SIZE");
+
+        // a delta is decoded on top of the previous frame
+
+        for (int k=0; k<len; k++)
+        {
+            scratch = decoded;
+            if (gStatus::decodeFrame(buf,k,&scratch))
+                return fail(n,"accepted a truncated frame");
+        }
+        if (gStatus::decodeFrame(buf,len,&decoded) != len)
+            return fail(n,"did not decode");
+        if (!sameFrame(&decoded,&frame))
+            return fail(n,"decoded to a different frame");
+
+        buf[0] ^= 0xff;
+        scratch = decoded;
+        if (gStatus::decodeFrame(buf,len,&scratch))
+            return fail(n,"accepted a bad magic number");
+
+        total += len;
+        num_full += full;
+        if (len > max_len)
+            max_len = len;
+        prev = frame;
+    }
+
+    printf("%d frames (%d full) round tripped\n",num_frames,num_full);
+    printf("average %0.1f bytes, largest %d, full %d, G_FRAME_MAX %d\n",
+        (float) total / num_frames,max_len,G_FRAME_FULL_SIZE,G_FRAME_MAX);
+    return 0;
+}
@@ -0,0 +1,14 @@
+// Linux stand-in for the FluidNC types used by gStatus.h
+
+#pragma once
+
+#include "System.h"     // State, from the mesh_sim stubs
+
+enum class SDState : uint8_t
+{
+    Idle = 0,
+    NotPresent,
+    Busy,
+    BusyUploading,
+    BusyParsing,
+};
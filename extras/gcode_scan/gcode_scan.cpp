@@ -0,0 +1,90 @@
+//-------------------------------------------------
+// gcode_scan - run GcodeScan over a file on Linux
+//-------------------------------------------------
+// Build from the library directory:
+//
+//   g++ -std=gnu++17 -O2 -I. -Iextras/mesh_sim/stubs
+//       -o gcode_scan extras/gcode_scan/*.cpp GcodeScan.cpp BufferedReader.cpp
+//
+// Usage:
+//
+//   gcode_scan [-r rapid_rate] [-a accel] file
+//
+// with the rapid rate in mm/min (default 3000) and the acceleration
+// in mm/s^2 (default 100).  Prints the estimated time, the time based
+// progress at each quarter of the file, and how fast it was scanned.
+
+#include <chrono>     // before Arduino.h and its abs() macro
+
+#include "GcodeScan.h"
+#include "BufferedReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void usage()
+{
+    fprintf(stderr,"usage: gcode_scan [-r rapid_rate] [-a accel] file\n");
+    exit(1);
+}
+
+
+int main(int argc, char **argv)
+{
+    float rapid_rate = 3000;
+    float accel = 100;
+    const char *filename = NULL;
+
+    for (int i=1; i<argc; i++)
+    {
+        if (!strcmp(argv[i],"-r") && i+1 < argc)
+            rapid_rate = atof(argv[++i]);
+        else if (!strcmp(argv[i],"-a") && i+1 < argc)
+            accel = atof(argv[++i]);
+        else if (argv[i][0] == '-' || filename)
+            usage();
+        else
+            filename = argv[i];
+    }
+    if (!filename)
+        usage();
+
+    FILE *fp = fopen(filename,"rb");
+    if (!fp)
+    {
+        perror(filename);
+        return 1;
+    }
+    File file(fp);
+    uint32_t size = file.size();
+
+    auto start = std::chrono::steady_clock::now();
+
+    g_gcode_scan.begin(size,rapid_rate,accel);
+    char line[GCODE_SCAN_LINE];
+    BufferedReader reader(file);
+    while (reader.readToken(line,GCODE_SCAN_LINE-1,"\n") >= 0)
+        g_gcode_scan.scanLine(line,reader.position());
+    g_gcode_scan.end();
+
+    double secs = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    file.close();
+
+    float total = g_gcode_scan.totalTime();
+    printf("%u lines, %u bytes\n",g_gcode_scan.lines(),size);
+    printf("estimated time %.1f seconds (%d:%02d:%02d)\n",total,
+        (int) total / 3600,((int) total / 60) % 60,(int) total % 60);
+    for (int quarter=1; quarter<=4; quarter++)
+    {
+        uint32_t offset = (uint64_t) size * quarter / 4;
+        float time = g_gcode_scan.timeAt(offset);
+        printf("  %3d%% of bytes = %5.1f%% of time\n",quarter * 25,
+            total > 0 ? 100.0 * time / total : 0.0);
+    }
+    printf("scanned in %.3f ms, %.1f MB/s\n",secs * 1000,
+        secs > 0 ? size / secs / 1e6 : 0.0);
+    return 0;
+}
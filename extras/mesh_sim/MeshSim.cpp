@@ -0,0 +1,172 @@
+//-------------------------------------------------
+// Synthetic-surface simulator for Mesh::doMeshLeveling()
+//-------------------------------------------------
+
+#include "MeshSim.h"
+#include "FluidDebug.h"
+
+#include <math.h>
+
+
+#define DEBUG_SIM  0
+
+
+float SimSurface::height(float x, float y) const
+{
+    float z = z0 + tilt_x * x + tilt_y * y;
+    if (warp != 0 && warp_period > 0)
+        z += warp * sinf(2 * M_PI * x / warp_period) * sinf(2 * M_PI * y / warp_period);
+    return z;
+}
+
+
+MeshSim::MeshSim(const SimSurface &surface, const SimMachine &machine, unsigned seed) :
+    m_surface(surface),
+    m_machine(machine),
+    m_rand(seed)
+{
+    m_pos[0] = machine.start_x;
+    m_pos[1] = machine.start_y;
+    m_pos[2] = machine.start_z;
+    m_time = 0;
+    m_aborted = false;
+    m_num_probes = 0;
+    m_num_moves = 0;
+    m_num_crashes = 0;
+}
+
+
+bool MeshSim::beginLeveling(float *mx, float *my)
+{
+    *mx = m_pos[0];
+    *my = m_pos[1];
+    return true;
+}
+
+
+bool MeshSim::moveXY(float x, float y, float feed)
+{
+    return move(x,y,m_pos[2],feed);
+}
+
+
+bool MeshSim::moveZ(float z, float feed)
+{
+    return move(m_pos[0],m_pos[1],z,feed);
+}
+
+
+bool MeshSim::rapidTo(float x, float y, float z)
+{
+    return move(x,y,z,m_machine.rapid_rate);
+}
+
+
+double MeshSim::blockTime(float len, float v0, float v1, float vmax)
+    // trapezoid (or triangle) time for one block
+{
+    float a = m_machine.accel;
+    float d_accel = (vmax*vmax - v0*v0) / (2*a);
+    float d_decel = (vmax*vmax - v1*v1) / (2*a);
+    if (d_accel + d_decel <= len)
+        return (vmax-v0)/a + (vmax-v1)/a + (len-d_accel-d_decel)/vmax;
+    float vpeak = sqrtf((2*a*len + v0*v0 + v1*v1) / 2);
+    return (vpeak-v0)/a + (vpeak-v1)/a;
+}
+
+
+bool MeshSim::move(float x, float y, float z, float feed)
+    // run one move, from and to rest
+{
+    if (m_aborted)
+        return false;
+
+    float to[3] = {x,y,z};
+    float d2 = 0;
+    for (int j=0; j<3; j++)
+        d2 += (to[j] - m_pos[j]) * (to[j] - m_pos[j]);
+    if (d2 > 0)
+        m_time += blockTime(sqrtf(d2),0,0,feed / 60.0);
+
+    // check that no travel move goes through the bed
+
+    if (x != m_pos[0] || y != m_pos[1])
+        checkTravel(m_pos,to);
+
+    #if DEBUG_SIM
+        g_debug("SIM: move to %0.3f,%0.3f,%0.3f time=%0.3f",x,y,z,m_time);
+    #endif
+
+    for (int j=0; j<3; j++)
+        m_pos[j] = to[j];
+    m_num_moves++;
+    return true;
+}
+
+
+void MeshSim::checkTravel(const float *from, const float *to)
+    // count an xy move that is below the bed anywhere along its path
+{
+    for (int k=0; k<=CRASH_SAMPLES; k++)
+    {
+        float t = (float) k / CRASH_SAMPLES;
+        float x = from[0] + t * (to[0] - from[0]);
+        float y = from[1] + t * (to[1] - from[1]);
+        float z = from[2] + t * (to[2] - from[2]);
+        if (z < m_surface.height(x,y))
+        {
+            g_error("SIM: travel move crashed at %0.3f,%0.3f z=%0.3f",x,y,z);
+            m_num_crashes++;
+            return;
+        }
+    }
+}
+
+
+bool MeshSim::probe(float z, float feed, float *zResult)
+{
+    if (m_aborted)
+        return false;
+
+    m_num_probes++;
+    if (m_machine.abort_after && m_num_probes >= m_machine.abort_after)
+    {
+        g_error("SIM: abort on probe %d",m_num_probes);
+        m_aborted = true;
+        return false;
+    }
+
+    std::normal_distribution<float> noise(0,m_surface.noise);
+    std::uniform_real_distribution<float> chance(0,1);
+
+    float contact = m_surface.height(m_pos[0],m_pos[1]);
+    if (m_surface.noise > 0)
+        contact += noise(m_rand);
+    if (m_surface.spike_prob > 0 && chance(m_rand) < m_surface.spike_prob)
+        contact += m_surface.spike_height;
+
+    if (contact > m_pos[2])
+    {
+        g_error("SIM: probe already tripped at z=%0.3f",m_pos[2]);
+        return false;
+    }
+
+    float stop = contact < z ? z : contact;
+    m_time += blockTime(m_pos[2]-stop,0,0,feed/60.0);
+    m_pos[2] = stop;
+
+    if (contact < z)
+    {
+        g_error("SIM: probe did not make contact");
+        return false;
+    }
+
+    *zResult = contact;
+    return true;
+}
+
+
+bool MeshSim::probeTripped()
+{
+    return m_pos[2] <= m_surface.height(m_pos[0],m_pos[1]);
+}
@@ -0,0 +1,90 @@
+//-------------------------------------------------
+// Synthetic-surface simulator for Mesh::doMeshLeveling()
+//-------------------------------------------------
+// A MeshBackend that stands in for FluidNC's probe, g38.2 and
+// motion, probing a configurable synthetic bed and accumulating
+// the simulated time the moves would have taken, each one from and
+// to rest.  Any xy move that passes below the bed is counted as a
+// crash.
+//
+// All positions are machine coordinates; the work coordinate
+// offset is taken to be zero, so the g38.2 target is a machine z.
+
+#pragma once
+
+#include "MeshBackend.h"
+
+#include <random>
+
+
+#define CRASH_SAMPLES   50      // points checked along each xy move
+
+
+struct SimSurface
+{
+    float z0            = -20.0;    // bed height at machine 0,0
+    float tilt_x        = 0.001;    // mm per mm
+    float tilt_y        = -0.0005;
+    float warp          = 0.05;     // amplitude of a sinusoidal warp in mm
+    float warp_period   = 200.0;    // mm
+    float noise         = 0.002;    // sigma of gaussian probe noise in mm
+    float spike_prob    = 0.0;      // chance per probe of an early trip
+    float spike_height  = 0.3;      // how early the spike trips in mm
+
+    float height(float x, float y) const;
+        // the ground truth
+};
+
+
+struct SimMachine
+{
+    float accel         = 200.0;    // mm/s^2, all axes
+    float rapid_rate    = 2000.0;   // mm/min for g0
+    float start_x       = 0.0;
+    float start_y       = 0.0;
+    float start_z       = 0.0;
+    int   abort_after   = 0;        // abort on this probe number, 0=never
+};
+
+
+class MeshSim : public MeshBackend
+{
+    public:
+
+        MeshSim(const SimSurface &surface, const SimMachine &machine, unsigned seed);
+
+        bool beginLeveling(float *mx, float *my) override;
+        void endLeveling() override {}
+        bool moveXY(float x, float y, float feed) override;
+        bool moveZ(float z, float feed) override;
+        bool rapidTo(float x, float y, float z) override;
+        bool probe(float z, float feed, float *zResult) override;
+        bool probeTripped() override;
+        void pulloffFailed() override {}
+        bool checkAbort() override      { return m_aborted; }
+        bool setWorkZ(float z) override { return !m_aborted; }
+        void goIdle() override {}
+
+        double elapsed()                { return m_time; }    // seconds
+        int numProbes()                 { return m_num_probes; }
+        int numMoves()                  { return m_num_moves; }
+        int numCrashes()                { return m_num_crashes; }
+
+    private:
+
+        SimSurface m_surface;
+        SimMachine m_machine;
+        std::mt19937 m_rand;
+
+        float   m_pos[3];               // where the machine is
+        double  m_time;
+        bool    m_aborted;
+
+        int     m_num_probes;
+        int     m_num_moves;
+        int     m_num_crashes;
+
+        bool move(float x, float y, float z, float feed);
+        void checkTravel(const float *from, const float *to);
+        double blockTime(float len, float v0, float v1, float vmax);
+};
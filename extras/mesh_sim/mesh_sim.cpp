@@ -0,0 +1,264 @@
+//-------------------------------------------------
+// mesh_sim - run Mesh::doMeshLeveling() on Linux
+//-------------------------------------------------
+// Build from the library directory:
+//
+//   g++ -std=gnu++17 -O2 -I. -Iextras/mesh_sim -Iextras/mesh_sim/stubs
+//       -o mesh_sim extras/mesh_sim/*.cpp Mesh.cpp BufferedReader.cpp
+//
+// Usage:
+//
+//   mesh_sim [-v] [-r|-R] [setting=value ...]
+//
+// -v shows the debug output, -r loads the mesh with readMesh()
+// instead of probing it, as at boot, and -R resumes a previous
+// run from its checkpoint (i.e. one stopped with sim.abort_after).
+//
+// where each setting is either a mesh setting (x_steps=9, num_probes=3,
+// pulloff=1, ...) passed to the mesh through a RuntimeSetting, or
+// one of the sim.* settings below for the synthetic bed and machine.
+// The mesh file is written to $MESH_SIM_SPIFFS (default ./spiffs).
+// A run that crashes the probe into the bed on a travel move fails.
+
+#include "MeshSim.h"
+#include "Mesh.h"
+#include "gCounters.h"
+
+#include <Configuration/RuntimeSetting.h>
+#include <Machine/MachineConfig.h>
+#include <System.h>
+
+#include <stdarg.h>
+
+
+system_t sys;
+Mesh the_mesh;
+gJobCounters_t g_job_counters;      // gStatus.cpp is not linked into the simulator
+
+static Machine::Axes sim_axes;
+static MachineConfig sim_config = { &sim_axes };
+MachineConfig *config = &sim_config;
+
+static bool verbose = false;
+static MeshSim *sim_backend = nullptr;
+
+
+MeshBackend *meshDefaultBackend()
+    // MeshBackend.cpp is not linked into the simulator
+{
+    return sim_backend;
+}
+
+
+void g_debug(const char *format, ...)
+{
+    if (!verbose)
+        return;
+    va_list var;
+    va_start(var, format);
+    printf("[MSG:DBG: ");
+    vprintf(format,var);
+    printf("]\n");
+    va_end(var);
+}
+
+void g_info(const char *format, ...)
+{
+    if (!verbose)
+        return;
+    va_list var;
+    va_start(var, format);
+    printf("[MSG:INFO: ");
+    vprintf(format,var);
+    printf("]\n");
+    va_end(var);
+}
+
+void g_error(const char *format, ...)
+{
+    va_list var;
+    va_start(var, format);
+    printf("[MSG:ERR: ");
+    vprintf(format,var);
+    printf("]\n");
+    va_end(var);
+}
+
+
+//------------------------------
+// settings
+//------------------------------
+
+static SimSurface surface;
+static SimMachine machine;
+static unsigned seed = 1;
+
+struct simParam
+{
+    const char *name;
+    float *value;
+};
+
+static const simParam sim_params[] =
+{
+    { "sim.z0",             &surface.z0 },
+    { "sim.tilt_x",         &surface.tilt_x },
+    { "sim.tilt_y",         &surface.tilt_y },
+    { "sim.warp",           &surface.warp },
+    { "sim.warp_period",    &surface.warp_period },
+    { "sim.noise",          &surface.noise },
+    { "sim.spike_prob",     &surface.spike_prob },
+    { "sim.spike_height",   &surface.spike_height },
+    { "sim.accel",          &machine.accel },
+    { "sim.rapid_rate",     &machine.rapid_rate },
+    { "sim.x",              &machine.start_x },
+    { "sim.y",              &machine.start_y },
+    { "sim.z",              &machine.start_z },
+};
+
+
+static bool setParam(const char *name, const char *value)
+{
+    if (!strcmp(name,"sim.seed"))
+    {
+        seed = atoi(value);
+        return true;
+    }
+    if (!strcmp(name,"sim.abort_after"))
+    {
+        machine.abort_after = atoi(value);
+        return true;
+    }
+    for (const simParam &param : sim_params)
+    {
+        if (!strcmp(name,param.name))
+        {
+            *param.value = atof(value);
+            return true;
+        }
+    }
+    if (!strncmp(name,"sim.",4))
+        return false;
+
+    Configuration::RuntimeSetting rts(name,value);
+    static_cast<Configuration::Configurable &>(the_mesh).group(rts);
+    return rts.isHandled_;
+}
+
+
+//------------------------------
+// evaluation
+//------------------------------
+
+static float meshZ(float mx, float my)
+    // the offset the mesh applies at a machine x,y
+{
+    float motors[3] = {mx,my,0};
+    float cartesian[3];
+    the_mesh.motors_to_cartesian(cartesian,motors,3);
+    return -cartesian[2];
+}
+
+
+static void meshError(int subdiv, float *max_err, float *rms_err)
+    // compare the mesh to the ground truth relative to the
+    // origin, subdiv points per cell (1 = just the probed points)
+{
+    float x0 = machine.start_x;
+    float y0 = machine.start_y;
+    float zero = surface.height(x0,y0);
+    int nx = (the_mesh.getXSteps()-1) * subdiv + 1;
+    int ny = (the_mesh.getYSteps()-1) * subdiv + 1;
+    float dx = the_mesh.getWidth() / (nx-1);
+    float dy = the_mesh.getHeight() / (ny-1);
+
+    double sum = 0;
+    *max_err = 0;
+    for (int y=0; y<ny; y++)
+    {
+        for (int x=0; x<nx; x++)
+        {
+            float mx = x0 + x*dx;
+            float my = y0 + y*dy;
+            float err = fabs(meshZ(mx,my) - (surface.height(mx,my) - zero));
+            if (err > *max_err)
+                *max_err = err;
+            sum += err * err;
+        }
+    }
+    *rms_err = sqrt(sum / (nx*ny));
+}
+
+
+int main(int argc, char **argv)
+{
+    sys.state = State::Idle;
+    bool read_only = false;
+    bool resume = false;
+
+    for (int i=1; i<argc; i++)
+    {
+        if (!strcmp(argv[i],"-v"))
+        {
+            verbose = true;
+            continue;
+        }
+        if (!strcmp(argv[i],"-r"))
+        {
+            read_only = true;
+            continue;
+        }
+        if (!strcmp(argv[i],"-R"))
+        {
+            resume = true;
+            continue;
+        }
+        char buf[128];
+        strncpy(buf,argv[i],sizeof(buf)-1);
+        buf[sizeof(buf)-1] = 0;
+        char *value = strchr(buf,'=');
+        if (!value || !setParam(buf,(*value++ = 0, value)))
+        {
+            printf("unknown setting: %s\n",argv[i]);
+            return 1;
+        }
+    }
+
+    MeshSim sim(surface,machine,seed);
+    sim_backend = &sim;
+    the_mesh.setBackend(&sim);
+
+    bool ok;
+    if (read_only)
+    {
+        the_mesh.readMesh();
+        ok = the_mesh.isValid();
+    }
+    else if (resume)
+        ok = the_mesh.resumeMeshLeveling();
+    else
+        ok = the_mesh.doMeshLeveling();
+    if (sim.numCrashes())
+        ok = false;
+
+    printf("mesh:          %dx%d over %0.1fx%0.1f mm\n",
+        the_mesh.getXSteps(),
+        the_mesh.getYSteps(),
+        the_mesh.getWidth(),
+        the_mesh.getHeight());
+    printf("result:        %s\n",ok ? "valid" : "FAILED");
+    printf("time:          %0.2f s\n",sim.elapsed());
+    printf("probes:        %d\n",sim.numProbes());
+    printf("moves:         %d\n",sim.numMoves());
+    printf("crashes:       %d\n",sim.numCrashes());
+
+    if (ok)
+    {
+        float max_err, rms_err;
+        meshError(1,&max_err,&rms_err);
+        printf("point error:   max %0.4f rms %0.4f mm\n",max_err,rms_err);
+        meshError(8,&max_err,&rms_err);
+        printf("surface error: max %0.4f rms %0.4f mm\n",max_err,rms_err);
+    }
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,39 @@
+// Linux stand-in for the parts of Arduino.h used by the mesh simulator
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <iostream>
+#include <string>
+#include <algorithm>
+
+// Arduino's abs() is a macro, so std headers must come first
+
+#ifndef abs
+    #define abs(x) ((x)>0?(x):-(x))
+#endif
+
+inline void delay(uint32_t ms) {}
+inline unsigned long millis()   { return 0; }
+
+
+class String
+{
+    public:
+
+        String(const char *s="") : m_str(s) {}
+
+        const char *c_str() const       { return m_str.c_str(); }
+        unsigned int length() const     { return m_str.length(); }
+        String &operator=(const char *s) { m_str = s; return *this; }
+        bool operator==(const char *s) const { return m_str == s; }
+
+    private:
+
+        std::string m_str;
+};
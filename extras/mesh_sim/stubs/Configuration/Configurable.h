@@ -0,0 +1,16 @@
+// Linux stand-in for FluidNC's Configuration::Configurable
+
+#pragma once
+
+#include "HandlerBase.h"
+
+namespace Configuration
+{
+    class Configurable
+    {
+        public:
+
+            virtual void group(HandlerBase& handler) = 0;
+            virtual ~Configurable() {}
+    };
+}
@@ -0,0 +1,20 @@
+// Linux stand-in for the parts of FluidNC's Configuration::HandlerBase
+// used by the mesh simulator (floats, bools and Strings only)
+
+#pragma once
+
+#include "HandlerType.h"
+#include <Arduino.h>
+
+namespace Configuration
+{
+    class HandlerBase
+    {
+        public:
+
+            virtual void item(const char* name, bool& value) = 0;
+            virtual void item(const char* name, float& value) = 0;
+            virtual void item(const char* name, String& value, int minLength = 0, int maxLength = 255) = 0;
+            virtual HandlerType handlerType() = 0;
+    };
+}
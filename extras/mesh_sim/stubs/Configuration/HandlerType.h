@@ -0,0 +1,8 @@
+// Linux stand-in for FluidNC's Configuration::HandlerType
+
+#pragma once
+
+namespace Configuration
+{
+    enum struct HandlerType { Parser, AfterParse, Runtime, Generator, Validator };
+}
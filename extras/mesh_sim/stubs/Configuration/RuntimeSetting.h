@@ -0,0 +1,60 @@
+// Linux stand-in for FluidNC's Configuration::RuntimeSetting.
+// Matches a single item name (no section path) within one group().
+
+#pragma once
+
+#include "HandlerBase.h"
+#include <stdlib.h>
+#include <strings.h>
+
+namespace Configuration
+{
+    class RuntimeSetting : public HandlerBase
+    {
+        public:
+
+            RuntimeSetting(const char* key, const char* value) :
+                setting_(key),
+                newValue_(value) {}
+
+            bool is(const char* name) const { return !strcasecmp(name,setting_); }
+
+            void item(const char* name, bool& value) override
+            {
+                if (is(name))
+                {
+                    isHandled_ = true;
+                    if (newValue_)
+                        value = !strcasecmp(newValue_,"true") || atoi(newValue_);
+                }
+            }
+            void item(const char* name, float& value) override
+            {
+                if (is(name))
+                {
+                    isHandled_ = true;
+                    if (newValue_)
+                        value = atof(newValue_);
+                }
+            }
+
+            void item(const char* name, String& value, int minLength, int maxLength) override
+            {
+                if (is(name))
+                {
+                    isHandled_ = true;
+                    if (newValue_)
+                        value = newValue_;
+                }
+            }
+
+            HandlerType handlerType() override { return HandlerType::Runtime; }
+
+            bool isHandled_ = false;
+
+        private:
+
+            const char* setting_;
+            const char* newValue_;
+    };
+}
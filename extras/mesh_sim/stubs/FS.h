@@ -0,0 +1,48 @@
+// Linux stand-in for the Arduino FS File used by the mesh simulator.
+// Files live in a local directory (see SPIFFS.h).
+
+#pragma once
+
+#include "Arduino.h"
+
+#define FILE_READ       "r"
+#define FILE_WRITE      "w"
+#define FILE_APPEND     "a"
+
+
+class File
+{
+    public:
+
+        File(FILE *fp=nullptr) : m_fp(fp) {}
+
+        operator bool() const   { return m_fp != nullptr; }
+
+        int read()              { return m_fp ? fgetc(m_fp) : -1; }
+        size_t read(uint8_t *buf, size_t size)
+            { return m_fp ? fread(buf,1,size,m_fp) : 0; }
+        size_t write(const uint8_t *buf, size_t size)
+            { return m_fp ? fwrite(buf,1,size,m_fp) : 0; }
+        size_t print(const char *s)
+            { return write((const uint8_t *)s,strlen(s)); }
+        size_t print(char c)
+            { return write((const uint8_t *)&c,1); }
+        size_t size()
+        {
+            if (!m_fp) return 0;
+            long pos = ftell(m_fp);
+            fseek(m_fp,0,SEEK_END);
+            long len = ftell(m_fp);
+            fseek(m_fp,pos,SEEK_SET);
+            return len;
+        }
+        void close()
+        {
+            if (m_fp) fclose(m_fp);
+            m_fp = nullptr;
+        }
+
+    private:
+
+        FILE *m_fp;
+};
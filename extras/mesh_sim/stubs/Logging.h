@@ -0,0 +1,9 @@
+// Linux stand-in for FluidNC's stream style log macros
+
+#pragma once
+
+#include <iostream>
+
+#define log_error(x)    (std::cerr << "[MSG:ERR: " << x << "]" << std::endl)
+#define log_info(x)     (std::cerr << "[MSG:INFO: " << x << "]" << std::endl)
+#define log_debug(x)    (std::cerr << "[MSG:DBG: " << x << "]" << std::endl)
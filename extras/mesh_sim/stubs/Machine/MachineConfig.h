@@ -0,0 +1,18 @@
+// Linux stand-in for FluidNC's MachineConfig used by the mesh simulator
+
+#pragma once
+
+namespace Machine
+{
+    struct Axes
+    {
+        int _numberAxis = 3;
+    };
+}
+
+struct MachineConfig
+{
+    Machine::Axes *_axes;
+};
+
+extern MachineConfig *config;
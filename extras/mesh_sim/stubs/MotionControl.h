@@ -0,0 +1,8 @@
+// Linux stand-in for FluidNC's MotionControl.h used by the mesh simulator
+
+#pragma once
+
+#include "Planner.h"
+#include "Logging.h"
+
+inline bool mc_line(float* target, plan_line_data_t* pl_data) { return true; }
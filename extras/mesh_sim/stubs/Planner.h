@@ -0,0 +1,22 @@
+// Linux stand-in for FluidNC's Planner.h used by the mesh simulator
+
+#pragma once
+
+#include "Arduino.h"
+
+#define MAX_N_AXIS  6
+
+const int X_AXIS = 0;
+const int Y_AXIS = 1;
+const int Z_AXIS = 2;
+
+struct PlMotion
+{
+    uint8_t rapidMotion : 1;
+};
+
+struct plan_line_data_t
+{
+    float    feed_rate;
+    PlMotion motion;
+};
@@ -0,0 +1,47 @@
+// Linux stand-in for SPIFFS used by the mesh simulator.
+// "/name" maps to $MESH_SIM_SPIFFS/name (default ./spiffs/name)
+
+#pragma once
+
+#include "FS.h"
+#include <string>
+#include <sys/stat.h>
+
+
+class SimSPIFFS
+{
+    public:
+
+        bool exists(const char *path)
+        {
+            struct stat st;
+            return !stat(local(path).c_str(),&st);
+        }
+        File open(const char *path, const char *mode=FILE_READ)
+        {
+            std::string m = mode;
+            if (m.find('b') == std::string::npos)
+                m += "b";
+            return File(fopen(local(path).c_str(),m.c_str()));
+        }
+        bool remove(const char *path)
+        {
+            return !::remove(local(path).c_str());
+        }
+        bool rename(const char *from, const char *to)
+        {
+            return !::rename(local(from).c_str(),local(to).c_str());
+        }
+
+    private:
+
+        std::string local(const char *path)
+        {
+            const char *root = getenv("MESH_SIM_SPIFFS");
+            std::string dir = root ? root : "spiffs";
+            mkdir(dir.c_str(),0755);
+            return dir + path;
+        }
+};
+
+static SimSPIFFS SPIFFS;
@@ -0,0 +1,26 @@
+// Linux stand-in for FluidNC's system state used by the mesh simulator
+
+#pragma once
+
+#include "Arduino.h"
+
+enum class State : uint8_t
+{
+    Idle = 0,
+    Alarm,
+    CheckMode,
+    Homing,
+    Cycle,
+    Hold,
+    Jog,
+    SafetyDoor,
+    Sleep,
+};
+
+struct system_t
+{
+    volatile bool  abort;
+    volatile State state;
+};
+
+extern system_t sys;
@@ -1,74 +1,661 @@
-//------------------------------------------------------------------
-// A namespace that consolidates my access to FluidNC internals
-//------------------------------------------------------------------
-
-#include "gActions.h"
-#include "FluidDebug.h"
-
-#include <SD.h>
-
-#include <GLimits.h>                // FluidNC
-#include <MotionControl.h>          // FluidNC
-#include <Protocol.h>               // FluidNC
-#include <Report.h>                 // FluidNC
-#include <SDCard.h>                 // FluidNC
-#include <Serial.h>                 // FluidNC
-#include <Settings.h>               // FluidNC
-#include <System.h>                 // FluidNC
-#include <Machine/MachineConfig.h>  // FluidNC
-#include <WebUI/Commands.h>         // FluidNC
-
-// overrides in protocol.h
-
-// extern volatile Percent rtFOverride;  // Feed override value in percent
-// extern volatile Percent rtROverride;  // Rapid feed override value in percent
-// extern volatile Percent rtSOverride;  // Spindle override value in percent
-//
-// rtAccessoryOverride.bit.coolantFloodOvrToggle
-
-
-namespace gActions
-{
-    void g_reset()						{ mc_reset(); }									// MotionControl.cpp
-	void g_limits_init()				{ limits_init(); }								// GLimits.cpp
-	void setAlarm(uint8_t alarm) 		{ rtAlarm = static_cast<ExecAlarm>(alarm); } 	// Protocol.cpp::rtAlarm
-	void setLimitMask(uint32_t mask) 	{ Machine::Axes::limitMask = mask; }
-	uint32_t getNegLimitMask()			{ return Machine::Axes::negLimitMask; }
-	uint32_t getPosLimitMask()			{ return Machine::Axes::posLimitMask; }
-    void setNegLimitMask(uint32_t mask) { Machine::Axes::negLimitMask = mask; }
-    void setPosLimitMask(uint32_t mask) { Machine::Axes::posLimitMask = mask; }
-	bool getProbeSucceeded() 			{ return probe_succeeded;	}					// MotionControl.cpp
-    void clearProbeSucceeded()			{ probe_succeeded = false; }					// MotionControl.cpp
-    void pushGrblText(const char *text)	{ WebUI::inputBuffer.push(text); }
-	void realtime_command(Cmd cmd)      { execute_realtime_command(cmd,allClients); }	// Serial.cpp
-
-    bool do_setting(char *buf)	// Settings.cpp
-	{
-		Error rslt = settings_execute_line(buf,allClients,WebUI::AuthenticationLevel::LEVEL_ADMIN);
-		if (rslt != Error::Ok)
-		{
-			g_error("Could not set parameter value");
-			return false;
-		}
-		return true;
-	}
-
-    bool startSDJob(const char *filename)	// SDCard.cpp
-	{
-		SDCard *sdCard = config->_sdCard;
-		if (sdCard && sdCard->begin(SDState::Idle) == SDState::Idle)
-		{
-			if (sdCard->openFile(SD,filename,allClients,WebUI::AuthenticationLevel::LEVEL_ADMIN))
-			{
-				sdCard->_readyNext = true;
-				return true;
-			}
-			else
-				g_error("Could not open file");
-		}
-		else
-			g_error("Could not get SDCard");
-		return false;
-	}
-
-};
+//------------------------------------------------------------------
+// A namespace that consolidates my access to FluidNC internals
+//------------------------------------------------------------------
+
+#include "gActions.h"
+#include "FluidDebug.h"
+#include "GcodeScan.h"
+#include "SDReadAhead.h"
+#include "BufferedReader.h"
+#include "Mesh.h"
+
+#include <SD.h>
+
+#include <GLimits.h>                // FluidNC
+#include <MotionControl.h>          // FluidNC
+#include <Planner.h>                // FluidNC
+#include <Protocol.h>               // FluidNC
+#include <Report.h>                 // FluidNC
+#include <SDCard.h>                 // FluidNC
+#include <Serial.h>                 // FluidNC
+#include <Settings.h>               // FluidNC
+#include <System.h>                 // FluidNC
+#include <Machine/MachineConfig.h>  // FluidNC
+#include <Configuration/Validator.h>    // FluidNC
+#include <WebUI/Commands.h>         // FluidNC
+
+// overrides in protocol.h
+
+// extern volatile Percent rtFOverride;  // Feed override value in percent
+// extern volatile Percent rtROverride;  // Rapid feed override value in percent
+// extern volatile Percent rtSOverride;  // Spindle override value in percent
+//
+// rtAccessoryOverride.bit.coolantFloodOvrToggle
+
+
+extern Mesh the_mesh __attribute__((weak));
+	// defined by the INO, if it uses a mesh. Weak, and at global
+	// scope, so that gActions::commitSettings() can see if it is
+
+
+namespace gActions
+{
+    void g_reset()						{ mc_reset(); }									// MotionControl.cpp
+	void g_limits_init()				{ limits_init(); }								// GLimits.cpp
+	void setAlarm(uint8_t alarm) 		{ rtAlarm = static_cast<ExecAlarm>(alarm); } 	// Protocol.cpp::rtAlarm
+	void setLimitMask(uint32_t mask) 	{ Machine::Axes::limitMask = mask; }
+	uint32_t getNegLimitMask()			{ return Machine::Axes::negLimitMask; }
+	uint32_t getPosLimitMask()			{ return Machine::Axes::posLimitMask; }
+    void setNegLimitMask(uint32_t mask) { Machine::Axes::negLimitMask = mask; }
+    void setPosLimitMask(uint32_t mask) { Machine::Axes::posLimitMask = mask; }
+	bool getProbeSucceeded() 			{ return probe_succeeded;	}					// MotionControl.cpp
+    void clearProbeSucceeded()			{ probe_succeeded = false; }					// MotionControl.cpp
+    void pushGrblText(const char *text)	{ WebUI::inputBuffer.push(text); }
+	void realtime_command(Cmd cmd)      { execute_realtime_command(cmd,allClients); }	// Serial.cpp
+
+	//----------------------------------------
+	// settings
+	//----------------------------------------
+	// Between beginSettings() and commitSettings() each setting is still
+	// applied as it comes, but the work that follows a change is done
+	// once at the commit: the mesh is re-read once rather than for each
+	// of its size parameters, the config tree is validated, and the
+	// YamlOverrides worker holds its (already coalesced) flash write
+	// until the transaction is over.
+	//
+	// It only defers that work.  Nothing is rolled back: a setting that
+	// failed, or a result that does not validate, is reported by the
+	// commit, and the settings that were applied stay applied.  A caller
+	// that gives up part way calls abortSettings(), and a transaction
+	// left open for SETTINGS_TIMEOUT_MS stops holding the flash write.
+
+	#ifndef SETTINGS_TIMEOUT_MS
+		#define SETTINGS_TIMEOUT_MS		10000
+	#endif
+
+	static volatile uint32_t settings_depth = 0;
+	static volatile uint32_t settings_errors = 0;
+	static volatile uint32_t settings_begin_ms = 0;
+	static volatile bool settings_timed_out = false;
+		// atomic, as settings may come from more than one task,
+		// though a transaction is shared by all of them
+
+
+	bool do_setting(char *buf)	// Settings.cpp
+	{
+		Error rslt = settings_execute_line(buf,allClients,WebUI::AuthenticationLevel::LEVEL_ADMIN);
+		if (rslt != Error::Ok)
+		{
+			g_error("Could not set parameter value: %s",buf);
+			if (__atomic_load_n(&settings_depth,__ATOMIC_ACQUIRE))
+				__atomic_fetch_add(&settings_errors,1,__ATOMIC_RELAXED);
+			return false;
+		}
+		return true;
+	}
+
+
+	void beginSettings()
+	{
+		if (__atomic_fetch_add(&settings_depth,1,__ATOMIC_ACQ_REL))
+			return;
+		__atomic_store_n(&settings_errors,0,__ATOMIC_RELAXED);
+		__atomic_store_n(&settings_begin_ms,millis(),__ATOMIC_RELAXED);
+		__atomic_store_n(&settings_timed_out,false,__ATOMIC_RELAXED);
+		if (&::the_mesh)
+			::the_mesh.deferValidation(true);
+	}
+
+
+	bool inSettings()
+	{
+		if (!__atomic_load_n(&settings_depth,__ATOMIC_ACQUIRE))
+			return false;
+		if (millis() - __atomic_load_n(&settings_begin_ms,__ATOMIC_RELAXED) < SETTINGS_TIMEOUT_MS)
+			return true;
+		if (!__atomic_exchange_n(&settings_timed_out,true,__ATOMIC_RELAXED))
+			g_error("beginSettings() without commitSettings() for %d ms",SETTINGS_TIMEOUT_MS);
+		return false;
+	}
+
+
+	void abortSettings()
+	{
+		if (!__atomic_exchange_n(&settings_depth,0,__ATOMIC_ACQ_REL))
+			return;
+		g_info("settings transaction aborted");
+		if (&::the_mesh)
+			::the_mesh.deferValidation(false);
+	}
+
+
+	bool commitSettings()
+	{
+		uint32_t depth = __atomic_load_n(&settings_depth,__ATOMIC_ACQUIRE);
+		do
+		{
+			if (!depth)
+			{
+				g_error("commitSettings() without beginSettings()");
+				return false;
+			}
+		} while (!__atomic_compare_exchange_n(&settings_depth,&depth,depth-1,
+					false,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE));
+		if (depth > 1)
+			return true;
+
+		uint32_t errors = __atomic_load_n(&settings_errors,__ATOMIC_RELAXED);
+		bool ok = !errors;
+		if (!ok)
+			g_error("%u settings failed",(unsigned) errors);
+
+		try
+		{
+			Configuration::Validator validator;
+			config->validate();
+			config->group(validator);
+		}
+		catch (std::exception &ex)
+		{
+			g_error("Settings validation error: %s",ex.what());
+			ok = false;
+		}
+
+		if (&::the_mesh)
+			::the_mesh.deferValidation(false);
+		return ok;
+	}
+
+
+	//----------------------------------------
+	// batches
+	//----------------------------------------
+	// Submitted text is copied into a ring, and a task pushes it, a line
+	// at a time, into WebUI::inputBuffer as that has room.  Batches run
+	// one after another.  FluidNC gives no per line result, so each batch
+	// is followed by an empty BATCH_ACK line: the protocol only reads a
+	// line once it has executed the one before, so when the ack has been
+	// read every line of the batch has been executed, and the batch is
+	// done once the planner is empty and the machine idle.  An alarm
+	// raised while it runs is the only failure seen.
+
+	#define BATCH_TEXT_SIZE		2048
+	#define MAX_BATCHES			8		// queued at once
+	#define BATCH_RESULTS		16		// finished batches remembered
+	#define BATCH_LINE			128
+	#define BATCH_POLL_MS		10
+	#define BATCH_ACK			"\n"
+
+	static StaticSemaphore_t batch_mutex_buf;
+	static SemaphoreHandle_t batch_mutex = NULL;
+		// between submitters, created by initBatches()
+
+	static char batch_text[BATCH_TEXT_SIZE];
+	static volatile uint32_t text_head = 0;			// written by submitBatch()
+	static volatile uint32_t text_tail = 0;			// consumed by the task
+	static uint32_t batch_ends[MAX_BATCHES];		// text_head after each batch
+	static volatile batch_t batches_submitted = 0;	// the last handle given out
+	static volatile batch_t batches_finished = 0;
+	static volatile batchState_t batch_results[BATCH_RESULTS];
+
+
+	static bool batchAlarm(bool *in_alarm)
+		// true if an alarm was raised since the batch started,
+		// so that a batch may be used to clear an alarm with $X
+	{
+		bool alarm = sys.state == State::Alarm || sys.abort;
+		bool raised = alarm && !*in_alarm;
+		*in_alarm = alarm;
+		return raised;
+	}
+
+
+	static bool runBatch(batch_t batch)
+	{
+		bool in_alarm = sys.state == State::Alarm;
+		uint32_t end = batch_ends[(batch - 1) % MAX_BATCHES];
+
+		while (text_tail != end)
+		{
+			char line[BATCH_LINE];
+			int len = 0;
+			uint32_t pos = text_tail;
+			while (pos != end)
+			{
+				char c = batch_text[pos++ % BATCH_TEXT_SIZE];
+				if (len < BATCH_LINE-1)
+					line[len++] = c;
+				if (c == '\n')
+					break;
+			}
+			line[len] = 0;
+			if (line[len-1] != '\n')
+			{
+				g_error("batch line too long: %s",line);
+				return false;
+			}
+
+			while (WebUI::inputBuffer.availableforwrite() <= len)
+			{
+				if (batchAlarm(&in_alarm))
+					return false;
+				vTaskDelay(BATCH_POLL_MS / portTICK_PERIOD_MS);
+			}
+			WebUI::inputBuffer.push(line);
+			text_tail = pos;
+		}
+
+		// the ack goes in after the last line, so it can only
+		// have been read once that line has been executed
+
+		while (WebUI::inputBuffer.availableforwrite() <= (int) strlen(BATCH_ACK))
+		{
+			if (batchAlarm(&in_alarm))
+				return false;
+			vTaskDelay(BATCH_POLL_MS / portTICK_PERIOD_MS);
+		}
+		WebUI::inputBuffer.push(BATCH_ACK);
+		while (true)
+		{
+			vTaskDelay(BATCH_POLL_MS / portTICK_PERIOD_MS);
+			if (batchAlarm(&in_alarm))
+				return false;
+			if (!WebUI::inputBuffer.available() &&
+				!plan_get_current_block() &&
+				(sys.state == State::Idle || sys.state == State::Alarm))
+				return true;
+		}
+	}
+
+
+	static void batchTask(void *param)
+	{
+		while (true)
+		{
+			if (batches_finished == batches_submitted)
+			{
+				vTaskDelay(BATCH_POLL_MS / portTICK_PERIOD_MS);
+				continue;
+			}
+
+			batch_t batch = batches_finished + 1;
+			bool ok = runBatch(batch);
+			if (!ok)
+			{
+				g_error("batch %u failed",(unsigned) batch);
+				text_tail = batch_ends[(batch - 1) % MAX_BATCHES];
+			}
+			batch_results[batch % BATCH_RESULTS] = ok ? BATCH_DONE : BATCH_FAILED;
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			batches_finished = batch;
+		}
+	}
+
+
+	void initBatches()
+	{
+		if (batch_mutex)
+			return;
+		batch_mutex = xSemaphoreCreateMutexStatic(&batch_mutex_buf);
+		if (xTaskCreate(batchTask,"gBatch",4096,NULL,1,NULL) != pdPASS)
+			g_error("Could not start batch task");
+	}
+
+
+	batch_t submitBatch(const char *text, uint32_t timeout_ms /*=portMAX_DELAY*/)
+	{
+		if (!batch_mutex)
+		{
+			g_error("submitBatch() before initBatches()");
+			return 0;
+		}
+
+		uint32_t len = strlen(text);
+		bool add_newline = !len || text[len-1] != '\n';
+		uint32_t need = len + add_newline;
+		if (need > BATCH_TEXT_SIZE)
+		{
+			g_error("batch of %u bytes is too big",(unsigned) need);
+			return 0;
+		}
+
+		uint32_t waited = 0;
+		while (true)
+		{
+			xSemaphoreTake(batch_mutex,portMAX_DELAY);
+			if (batches_submitted - batches_finished < MAX_BATCHES &&
+				text_head - text_tail + need <= BATCH_TEXT_SIZE)
+			{
+				uint32_t head = text_head;
+				for (uint32_t i=0; i<len; i++)
+					batch_text[head++ % BATCH_TEXT_SIZE] = text[i];
+				if (add_newline)
+					batch_text[head++ % BATCH_TEXT_SIZE] = '\n';
+
+				batch_t batch = batches_submitted + 1;
+				batch_ends[(batch - 1) % MAX_BATCHES] = head;
+				text_head = head;
+				__atomic_thread_fence(__ATOMIC_SEQ_CST);
+				batches_submitted = batch;
+				xSemaphoreGive(batch_mutex);
+				return batch;
+			}
+			xSemaphoreGive(batch_mutex);
+
+			if (waited >= timeout_ms)
+				return 0;
+			vTaskDelay(BATCH_POLL_MS / portTICK_PERIOD_MS);
+			waited += BATCH_POLL_MS;
+		}
+	}
+
+
+	batchState_t getBatchState(batch_t batch)
+	{
+		batch_t finished = batches_finished;
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (!batch || batch > batches_submitted)
+			return BATCH_NONE;
+		if (batch == finished + 1)
+			return BATCH_RUNNING;
+		if (batch > finished)
+			return BATCH_QUEUED;
+		if (finished - batch >= BATCH_RESULTS)
+			return BATCH_NONE;
+		return batch_results[batch % BATCH_RESULTS];
+	}
+
+
+	batchState_t waitBatch(batch_t batch, uint32_t timeout_ms /*=portMAX_DELAY*/)
+	{
+		uint32_t waited = 0;
+		while (true)
+		{
+			batchState_t state = getBatchState(batch);
+			if (state != BATCH_QUEUED && state != BATCH_RUNNING)
+				return state;
+			if (waited >= timeout_ms)
+				return state;
+			vTaskDelay(BATCH_POLL_MS / portTICK_PERIOD_MS);
+			waited += BATCH_POLL_MS;
+		}
+	}
+
+
+	//----------------------------------------
+	// G-code prescan
+	//----------------------------------------
+	// The job file is opened a second time and scanned by a low
+	// priority task while the job runs, for gStatus::getETA().
+	// The limits are the slowest of the X and Y axes.
+	// The scan is paced to SCAN_BYTES_PER_MS, so that it only takes
+	// a small share of the SD (and its SPI bus) from the job itself.
+
+	#ifndef SCAN_BYTES_PER_MS
+		#define SCAN_BYTES_PER_MS	32		// 32K per second
+	#endif
+	#define SCAN_YIELD_LINES	64
+
+	static char scan_filename[128];
+	static volatile bool scan_running = false;
+
+	static void scanTask(void *param)
+	{
+		File file = SD.open(scan_filename);
+		if (file)
+		{
+			float rapid_rate = config->_axes->_axis[X_AXIS]->_maxRate;
+			float accel = config->_axes->_axis[X_AXIS]->_acceleration;
+			Machine::Axis *y_axis = config->_axes->_axis[Y_AXIS];
+			if (y_axis && y_axis->_maxRate < rapid_rate)
+				rapid_rate = y_axis->_maxRate;
+			if (y_axis && y_axis->_acceleration < accel)
+				accel = y_axis->_acceleration;
+
+			g_gcode_scan.begin(file.size(),rapid_rate,accel);
+
+			int count = 0;
+			char line[GCODE_SCAN_LINE];
+			BufferedReader reader(file);
+			uint32_t start = millis();
+			while (g_gcode_scan.scanning() &&
+				   reader.readToken(line,GCODE_SCAN_LINE-1,"\n") >= 0)
+			{
+				g_gcode_scan.scanLine(line,reader.position());
+
+				int32_t ahead = start + reader.position() / SCAN_BYTES_PER_MS - millis();
+				if (ahead > 0)
+					vTaskDelay(ahead / portTICK_PERIOD_MS + 1);
+				else if (++count % SCAN_YIELD_LINES == 0)
+					vTaskDelay(1);
+			}
+			g_gcode_scan.end();
+			file.close();
+
+			g_debug("scanned %d lines, estimate %d seconds",
+				g_gcode_scan.lines(),
+				(int) g_gcode_scan.totalTime());
+		}
+		else
+			g_error("Could not open %s for scanning",scan_filename);
+
+		scan_running = false;
+		vTaskDelete(NULL);
+	}
+
+
+	static void startScan(const char *filename)
+	{
+		// stop any previous scan and wait for its task to exit
+
+		g_gcode_scan.abort();
+		for (int i=0; i<100 && scan_running; i++)
+			vTaskDelay(1);
+		if (scan_running)
+		{
+			g_error("previous scan did not stop");
+			return;
+		}
+
+		strncpy(scan_filename,filename,sizeof(scan_filename)-1);
+		scan_filename[sizeof(scan_filename)-1] = 0;
+		scan_running = true;
+		if (xTaskCreate(scanTask,"gcodeScan",4096,NULL,1,NULL) != pdPASS)
+		{
+			scan_running = false;
+			g_error("Could not start scan task");
+		}
+	}
+
+
+	//----------------------------------------
+	// SD read-ahead
+	//----------------------------------------
+	// The gReadAhead task fills g_sd_read_ahead from the job file in
+	// blocks, and FluidNC is given the job through read_ahead_fs, whose
+	// one File reads from the ring.  So FluidNC still runs the job, with
+	// the SDCard Busy (which keeps its begin() from remounting the card
+	// under the open file), and stops it on an error, a reset, or the end
+	// of the file, all of which close the File and so stop the task.
+
+	#if SD_READ_AHEAD
+
+	#define SD_READ_BLOCK		2048
+
+	static_assert(SD_READ_AHEAD_SIZE >= SD_READ_BLOCK,"SD_READ_AHEAD_SIZE is less than a block");
+
+	static File sd_job_file;
+	static char sd_job_name[128];
+	static volatile bool read_ahead_running = false;
+
+
+	static void readAheadTask(void *param)
+	{
+		while (g_sd_read_ahead.busy())
+		{
+			// wait for room for a whole block, which may be
+			// read in two parts when it wraps
+
+			if (g_sd_read_ahead.freeSpace() < SD_READ_BLOCK)
+			{
+				vTaskDelay(1);
+				continue;
+			}
+			uint32_t len;
+			uint8_t *space = g_sd_read_ahead.writeSpace(&len);
+			int got = sd_job_file.read(space,len < SD_READ_BLOCK ? len : SD_READ_BLOCK);
+			if (got > 0)
+			{
+				g_sd_read_ahead.written(got);
+				continue;
+			}
+			if (sd_job_file.position() < g_sd_read_ahead.fileSize())
+			{
+				g_error("SD read error at %u",(unsigned) sd_job_file.position());
+				g_sd_read_ahead.abort();	// FluidNC sees a short file
+			}
+			else
+				g_sd_read_ahead.endOfFile();
+			break;
+		}
+		sd_job_file.close();
+		read_ahead_running = false;
+		vTaskDelete(NULL);
+	}
+
+
+	class ReadAheadFileImpl : public fs::FileImpl
+		// the File FluidNC reads the job from
+	{
+		public:
+
+			ReadAheadFileImpl() : m_open(true) {}
+
+			size_t read(uint8_t *buf, size_t size)
+			{
+				// wait, as a slow card would, when it is empty
+
+				int got;
+				while (!(got = g_sd_read_ahead.read(buf,size)))
+					vTaskDelay(1);
+				return got < 0 ? 0 : got;
+			}
+			void close()					{ m_open = false; g_sd_read_ahead.abort(); }
+			size_t position() const			{ return g_sd_read_ahead.position(); }
+			size_t size() const
+				// cut short if the reader failed, so FluidNC sees the end
+				{ return g_sd_read_ahead.busy() ? g_sd_read_ahead.fileSize() : g_sd_read_ahead.position(); }
+			const char *path() const		{ return sd_job_name; }
+			const char *name() const		{ return sd_job_name; }
+			operator bool()					{ return m_open; }
+
+			// the rest of fs::FileImpl, read only, and not a directory
+
+			size_t write(const uint8_t *buf, size_t size)	{ return 0; }
+			void flush()									{}
+			bool seek(uint32_t pos, SeekMode mode)			{ return false; }
+			bool setBufferSize(size_t size)					{ return false; }
+			time_t getLastWrite()							{ return 0; }
+			boolean isDirectory(void)						{ return false; }
+			fs::FileImplPtr openNextFile(const char *mode)	{ return fs::FileImplPtr(); }
+			boolean seekDir(long position)					{ return false; }
+			String getNextFileName(void)					{ return String(); }
+			String getNextFileName(bool *isDir)				{ return String(); }
+			void rewindDirectory(void)						{}
+
+		private:
+
+			bool m_open;
+	};
+
+
+	class ReadAheadFSImpl : public fs::FSImpl
+		// serves the one job that startReadAhead() has started
+	{
+		public:
+
+			fs::FileImplPtr open(const char *path, const char *mode, const bool create)
+			{
+				if (!g_sd_read_ahead.busy())
+					return fs::FileImplPtr();
+				return std::make_shared<ReadAheadFileImpl>();
+			}
+			bool exists(const char *path)						{ return g_sd_read_ahead.busy(); }
+			bool rename(const char *from, const char *to)		{ return false; }
+			bool remove(const char *path)						{ return false; }
+			bool mkdir(const char *path)						{ return false; }
+			bool rmdir(const char *path)						{ return false; }
+	};
+
+	static fs::FS read_ahead_fs(std::make_shared<ReadAheadFSImpl>());
+
+
+	static bool startReadAhead(const char *filename)
+	{
+		// wait for the task of a stopped job to exit
+
+		if (g_sd_read_ahead.busy())
+		{
+			g_error("An SD job is already running");
+			return false;
+		}
+		for (int i=0; i<100 && read_ahead_running; i++)
+			vTaskDelay(1);
+		if (read_ahead_running)
+		{
+			g_error("previous SD job did not stop");
+			return false;
+		}
+
+		sd_job_file = SD.open(filename);
+		if (!sd_job_file)
+			return false;
+
+		strncpy(sd_job_name,filename,sizeof(sd_job_name)-1);
+		sd_job_name[sizeof(sd_job_name)-1] = 0;
+		g_sd_read_ahead.begin(sd_job_file.size());
+		read_ahead_running = true;
+		if (xTaskCreate(readAheadTask,"gReadAhead",4096,NULL,1,NULL) != pdPASS)
+		{
+			read_ahead_running = false;
+			g_sd_read_ahead.abort();
+			sd_job_file.close();
+			g_error("Could not start read-ahead task");
+			return false;
+		}
+		return true;
+	}
+
+	#endif	// SD_READ_AHEAD
+
+
+    bool startSDJob(const char *filename)	// SDCard.cpp
+	{
+		SDCard *sdCard = config->_sdCard;
+		if (sdCard && sdCard->begin(SDState::Idle) == SDState::Idle)
+		{
+			#if SD_READ_AHEAD
+				if (startReadAhead(filename) &&
+					sdCard->openFile(read_ahead_fs,filename,allClients,WebUI::AuthenticationLevel::LEVEL_ADMIN))
+			#else
+				if (sdCard->openFile(SD,filename,allClients,WebUI::AuthenticationLevel::LEVEL_ADMIN))
+			#endif
+			{
+				sdCard->_readyNext = true;
+				startScan(filename);
+				return true;
+			}
+			else
+			{
+				#if SD_READ_AHEAD
+					g_sd_read_ahead.abort();
+				#endif
+				g_error("Could not open file");
+			}
+		}
+		else
+			g_error("Could not get SDCard");
+		return false;
+	}
+
+};
@@ -1,34 +1,72 @@
-//------------------------------------------------------------------
-// A namespace that consolidates my access to FluidNC internals
-//------------------------------------------------------------------
-// besides the 'state' from gStatus, this namespace provides
-// a set of consolidated entry points to "do" things in FluidNC,
-// hiding the various multiple FluidNC objects from clients.
-
-
-#pragma once
-
-#include <FluidTypes.h>
-
-
-namespace gActions
-{
-    extern void g_reset();                          // MotionControl.cpp::mc_reset()
-    extern void g_limits_init();                    // GLimits.cpp::limits_init();
-
-    extern void setAlarm(uint8_t alarm);            // Protocol.cpp::rtAlarm
-    extern void setLimitMask(uint32_t mask);        // Machine::Axes::limitMask
-    extern uint32_t getNegLimitMask();              // Machine::Axes::neg and posLimitMasks
-    extern uint32_t getPosLimitMask();
-    extern void setNegLimitMask(uint32_t mask);
-    extern void setPosLimitMask(uint32_t mask);
-    extern bool getProbeSucceeded();                // MotionControl.cpp::probe_succeeded
-    extern void clearProbeSucceeded();              // MotionControl.cpp::probe_succeeded = false;
-
-    extern void pushGrblText(const char *text);     // WebUI::inputBuffer.push()
-    extern void realtime_command(Cmd cmd);          // Serial.cpp::execute_realtime_command()
-
-    extern bool do_setting(char *buf);              // Settings.cpp::settings_execute_line() - should be const char*
-    extern bool startSDJob(const char *filename);   // SDCard.cpp mas o menus
-
-};
+//------------------------------------------------------------------
+// A namespace that consolidates my access to FluidNC internals
+//------------------------------------------------------------------
+// besides the 'state' from gStatus, this namespace provides
+// a set of consolidated entry points to "do" things in FluidNC,
+// hiding the various multiple FluidNC objects from clients.
+
+
+#pragma once
+
+#include <Arduino.h>
+#include <FluidTypes.h>
+
+
+// batches of gcode lines and $commands
+
+typedef uint32_t batch_t;           // a handle, 0 if it was not queued
+
+typedef enum
+{
+    BATCH_NONE,                     // not a handle, or too old to remember
+    BATCH_QUEUED,
+    BATCH_RUNNING,                  // being pushed, or waiting for it to finish
+    BATCH_DONE,
+    BATCH_FAILED,                   // an alarm was raised while it ran
+} batchState_t;
+
+
+namespace gActions
+{
+    extern void g_reset();                          // MotionControl.cpp::mc_reset()
+    extern void g_limits_init();                    // GLimits.cpp::limits_init();
+
+    extern void setAlarm(uint8_t alarm);            // Protocol.cpp::rtAlarm
+    extern void setLimitMask(uint32_t mask);        // Machine::Axes::limitMask
+    extern uint32_t getNegLimitMask();              // Machine::Axes::neg and posLimitMasks
+    extern uint32_t getPosLimitMask();
+    extern void setNegLimitMask(uint32_t mask);
+    extern void setPosLimitMask(uint32_t mask);
+    extern bool getProbeSucceeded();                // MotionControl.cpp::probe_succeeded
+    extern void clearProbeSucceeded();              // MotionControl.cpp::probe_succeeded = false;
+
+    extern void pushGrblText(const char *text);     // WebUI::inputBuffer.push()
+    extern void realtime_command(Cmd cmd);          // Serial.cpp::execute_realtime_command()
+
+    extern bool do_setting(char *buf);              // Settings.cpp::settings_execute_line() - should be const char*
+    extern void beginSettings();
+    extern bool commitSettings();
+        // Apply a group of do_setting()s as one transaction, so that the mesh
+        // re-read, config validation, and the YamlOverrides flash write are
+        // done once, at the commit. Returns false if any setting in it failed,
+        // or the result does not validate. They may nest.  Only that work is
+        // deferred: each setting is applied as it comes, and is not undone.
+    extern void abortSettings();
+        // end the transaction, at any depth, without validating it
+    extern bool inSettings();
+        // between beginSettings() and commitSettings(), for at most SETTINGS_TIMEOUT_MS
+    extern bool startSDJob(const char *filename);   // SDCard.cpp mas o menus
+
+    extern void initBatches();
+        // create the batch mutex and start the gBatch task, once,
+        // from setup(), before anything calls submitBatch()
+    extern batch_t submitBatch(const char *text, uint32_t timeout_ms=portMAX_DELAY);
+        // Queue newline separated lines to be pushed into WebUI::inputBuffer
+        // as it has room, waiting upto timeout_ms (0 to not wait) for room in
+        // the queue. Returns 0 if it could not be queued.
+    extern batchState_t getBatchState(batch_t batch);
+    extern batchState_t waitBatch(batch_t batch, uint32_t timeout_ms=portMAX_DELAY);
+        // wait until the batch is done or failed, or the timeout,
+        // returning its state
+
+};
@@ -0,0 +1,35 @@
+//-------------------------------------------------
+// Fixed size axis vectors
+//-------------------------------------------------
+// gStatus and Mesh handle positions for a number of axes fixed at
+// compile time (G_NUM_AXIS and MESH_NUM_AXIS), so that the loops over
+// them have constant counts and are unrolled, rather than clearing and
+// copying MAX_N_AXIS sized arrays on every call.  Plain C++ without
+// FluidNC, so that the mesh simulator can use it.
+
+#pragma once
+
+
+template <int N, typename T, typename S>
+inline void axesCopy(T *dst, const S *src)
+{
+    for (int i=0; i<N; i++)
+        dst[i] = src[i];
+}
+
+
+template <int N>
+inline void axesAdd(float *dst, const float *inc)
+{
+    for (int i=0; i<N; i++)
+        dst[i] += inc[i];
+}
+
+
+template <int N>
+inline void axesDelta(float *delta, const float *to, const float *from, float scale=1.0)
+    // delta = (to - from) * scale
+{
+    for (int i=0; i<N; i++)
+        delta[i] = (to[i] - from[i]) * scale;
+}
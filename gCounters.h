@@ -0,0 +1,37 @@
+//-------------------------------------------------
+// Per-job performance counters
+//-------------------------------------------------
+// Counted where they happen, in the mesh kinematics and in gStatus's
+// polling of the planner, SD card and probe, so that a slow job can be
+// put down to the planner, the mesh segmentation, or the SD streaming.
+// This header does not include FluidNC so that Mesh.cpp can count with
+// it in the simulator.  gStatus resets the counters when an SD job or
+// mesh leveling starts, and they are shown by $mesh/counters.
+
+#pragma once
+
+#include <stdint.h>
+
+
+typedef struct
+{
+    uint32_t start_ms;          // millis() at the reset
+    uint32_t segments;          // mc_line()s from Mesh::cartesian_to_motors()
+    uint32_t mc_line_retries;   // ... that failed and were retried
+    uint32_t delay_ms;          // time in its yield and retry delays
+    uint32_t z_offset_calls;    // Mesh::getZOffset()
+    uint32_t planner_empty;     // times gStatus saw the planner drain in a job
+    uint32_t sd_stalls;         // ... and stay empty with the file not moving on
+    uint32_t probes;            // probe cycles started
+} gJobCounters_t;
+
+
+extern gJobCounters_t g_job_counters;
+    // defined in gStatus.cpp
+
+
+inline void gCount(uint32_t *counter, uint32_t n=1)
+    // from any task
+{
+    __atomic_fetch_add(counter,n,__ATOMIC_RELAXED);
+}
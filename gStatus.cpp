@@ -1,337 +1,893 @@
-//-------------------------------------------------------
-// An object that abstracts the state of FluidNC
-//-------------------------------------------------------
-
-#include "gStatus.h"
-#include "FluidDebug.h"
-
-#include <WiFi.h>
-
-#include <MotionControl.h>		    // FluidNC
-#include <Protocol.h>		      	// FluidNC
-#include <SDCard.h>                 // FluidNC
-#include <Serial.h>                 // FluidNC
-#include <Machine/MachineConfig.h>  // FluidNC
-
-
-#define DEBUG_WIFI  0
-
-gStatus g_status;
-
-
-
-//---------------------------------------------
-// wrappers
-//---------------------------------------------
-
-SDState gStatus::getSDState(bool refresh/*=false*/)
-{
-	if (refresh && config->_sdCard)
-		return config->_sdCard->begin(SDState::Idle);
-	return m_sdcard_state;
-}
-
-
-float gStatus::getFeedRate()				{ return Stepper::get_realtime_rate(); }
-float gStatus::getAxisMaxTravel(int axis)	{ return config->_axes->_axis[axis]->_maxTravel; }
-float gStatus::getAxisPulloff(int axis)		{ return config->_axes->_axis[axis]->_motors[0]->_pulloff; }
-float gStatus::getAxisSeekRate(int axis)	{ return config->_axes->_axis[axis]->_homing->_seekRate; }     // the faster of the two
-float gStatus::getAxisFeedRate(int axis)	{ return config->_axes->_axis[axis]->_homing->_feedRate; }
-bool  gStatus::getProbeState()				{ return (bool) probeState; } // in MotionControl.cpp
-volatile float gStatus::getFeedOverride()	{ return rtFOverride; }	// in Protocol.cpp
-float gStatus::getRapidFeedOverride()		{ return rtROverride; }	// in Protocol.cpp
-float gStatus::getSpindleOverride()			{ return rtSOverride; }	// in Protocol.cpp
-
-
-//-----------------------------
-// static name methods
-//-----------------------------
-
-const char *jobStateName(JobState job_state)
-{
-    switch (job_state)
-    {
-        case JOB_NONE    : return "";
-        case JOB_IDLE    : return "IDLE";
-        case JOB_BUSY    : return "BUSY";
-        case JOB_HOLD    : return "HOLD";
-        case JOB_HOMING  : return "HOMING";
-        case JOB_PROBING : return "PROBING";
-        case JOB_MESHING : return "MESHING";
-        case JOB_ALARM   : return "ALARM";
-    }
-    return "UNKNOWN_JOB_STATE";
-}
-
-
-const char *sysStateName(State state)
-{
-	switch (state)
-	{
-		case State::Idle       : return "Idle";
-		case State::Alarm      : return "Alarm";
-		case State::CheckMode  : return "CheckMode";
-		case State::Homing     : return "Homing";
-		case State::Cycle      : return "Cycle";
-		case State::Hold       : return "Hold";
-		case State::Jog        : return "Jog";
-		case State::SafetyDoor : return "SafetyDoor";
-		case State::Sleep      : return "Sleep";
-	}
-	return "UNKNOWN_STATE";
-}
-
-
-const char *sdStateName(SDState state)
-	// BusyPrinting is same as Busy
-{
-	switch (state)
-	{
-		case SDState::Idle          : return "Idle";
-		case SDState::NotPresent    : return "NotPresent";
-		case SDState::Busy  		  : return "Busy";
-		case SDState::BusyUploading : return "BusyUploading";
-		case SDState::BusyParsing   : return "BusyParsing";
-	}
-	return "UNKNOWN_SD_STATE";
-}
-
-
-
-//-------------------------------
-// Wifi
-//-------------------------------
-
-#if DEBUG_WIFI
-	static const char *wifiEventName(WiFiEvent_t event)
-	{
-		switch (event)
-		{
-			case SYSTEM_EVENT_WIFI_READY	        : return "WIFI_READY";
-			case SYSTEM_EVENT_SCAN_DONE	            : return "SCAN_DONE";
-			case SYSTEM_EVENT_STA_START	            : return "STA_START";
-			case SYSTEM_EVENT_STA_STOP	            : return "STA_STOP";
-			case SYSTEM_EVENT_STA_CONNECTED	        : return "STA_CONNECTED";
-			case SYSTEM_EVENT_STA_DISCONNECTED	    : return "STA_DISCONNECTED";
-			case SYSTEM_EVENT_STA_AUTHMODE_CHANGE	: return "STA_AUTHMODE_CHANGE";
-			case SYSTEM_EVENT_STA_GOT_IP	        : return "STA_GOT_IP";
-			case SYSTEM_EVENT_STA_LOST_IP	        : return "STA_LOST_IP";
-			case SYSTEM_EVENT_STA_WPS_ER_SUCCESS	: return "STA_WPS_ER_SUCCESS";
-			case SYSTEM_EVENT_STA_WPS_ER_FAILED	    : return "STA_WPS_ER_FAILED";
-			case SYSTEM_EVENT_STA_WPS_ER_TIMEOUT	: return "STA_WPS_ER_TIMEOUT";
-			case SYSTEM_EVENT_STA_WPS_ER_PIN	    : return "STA_WPS_ER_PIN";
-			case SYSTEM_EVENT_AP_START	            : return "AP_START";
-			case SYSTEM_EVENT_AP_STOP	            : return "AP_STOP";
-			case SYSTEM_EVENT_AP_STACONNECTED	    : return "AP_STACONNECTED";
-			case SYSTEM_EVENT_AP_STADISCONNECTED	: return "AP_STADISCONNECTED";
-			case SYSTEM_EVENT_AP_STAIPASSIGNED	    : return "AP_STAIPASSIGNED";
-			case SYSTEM_EVENT_AP_PROBEREQRECVED	    : return "AP_PROBEREQRECVED";
-			case SYSTEM_EVENT_GOT_IP6	            : return "GOT_IP6";
-			case SYSTEM_EVENT_ETH_START	            : return "ETH_START";
-			case SYSTEM_EVENT_ETH_STOP	            : return "ETH_STOP";
-			case SYSTEM_EVENT_ETH_CONNECTED         : return "ETH_CONNECTED	ESP32";
-			case SYSTEM_EVENT_ETH_DISCONNECTED	    : return "ETH_DISCONNECTED";
-			case SYSTEM_EVENT_ETH_GOT_IP	        : return "ETH_GOT_IP";
-		}
-		return "UNKNOWN_WIFI_EVENT";
-	}
-#endif
-
-
-void gStatus::gWifiEvent(uint16_t event)
-{
-	switch (static_cast<WiFiEvent_t>(event))
-	{
-		case SYSTEM_EVENT_STA_DISCONNECTED         :    // ESP32 station disconnected from AP
-		case SYSTEM_EVENT_AP_STADISCONNECTED       :    // a station disconnected from ESP32 soft-AP
-			m_wifi_state = IND_STATE_ENABLED;
-			break;
-
-		// case SYSTEM_EVENT_SCAN_DONE                :    // ESP32 finish scanning AP
-		case SYSTEM_EVENT_AP_START                 :    // ESP32 soft-AP start
-		case SYSTEM_EVENT_STA_START                :    // ESP32 station start
-			m_wifi_state = IND_STATE_ACTIVE;
-			break;
-
-		case SYSTEM_EVENT_WIFI_READY 			   :
-		case SYSTEM_EVENT_AP_STACONNECTED          :    // a station connected to ESP32 soft-AP
-		case SYSTEM_EVENT_STA_GOT_IP               :    // ESP32 station got IP from connected AP
-		case SYSTEM_EVENT_STA_CONNECTED            :    // ESP32 station connected to AP
-		case SYSTEM_EVENT_STA_WPS_ER_SUCCESS       :    // ESP32 station wps succeeds in enrollee mode
-			m_wifi_state = IND_STATE_READY;
-			break;
-
-		case SYSTEM_EVENT_AP_STOP                  :    // ESP32 soft-AP stop
-		// case SYSTEM_EVENT_STA_STOP                 :    // ESP32 station stop
-		case SYSTEM_EVENT_STA_LOST_IP              :    // ESP32 station lost IP and the IP is reset to 0
-		case SYSTEM_EVENT_STA_WPS_ER_FAILED        :    // ESP32 station wps fails in enrollee mode
-		case SYSTEM_EVENT_STA_WPS_ER_TIMEOUT       :    // ESP32 station wps timeout in enrollee mode
-		case SYSTEM_EVENT_STA_WPS_ER_PIN           :    // ESP32 station wps pin code in enrollee mode
-			m_wifi_state = IND_STATE_ERROR;
-			break;
-
-		// case SYSTEM_EVENT_STA_AUTHMODE_CHANGE      :    // the auth mode of AP connected by ESP32 station changed
-		// case SYSTEM_EVENT_AP_STAIPASSIGNED         :    // ESP32 soft-AP assign an IP to a connected station
-		// case SYSTEM_EVENT_AP_PROBEREQRECVED        :    // Receive probe request packet in soft-AP interface
-		// case SYSTEM_EVENT_GOT_IP6                  :    // ESP32 station or ap or ethernet interface v6IP addr is preferred
-		// case SYSTEM_EVENT_ETH_START                :    // ESP32 ethernet start
-		// case SYSTEM_EVENT_ETH_STOP                 :    // ESP32 ethernet stop
-		// case SYSTEM_EVENT_ETH_CONNECTED            :    // ESP32 ethernet phy link up
-		// case SYSTEM_EVENT_ETH_DISCONNECTED         :    // ESP32 ethernet phy link down
-		// case SYSTEM_EVENT_ETH_GOT_IP               :    // ESP32 ethernet got IP from connected AP
-		// case SYSTEM_EVENT_MAX
-	}
-}
-
-
-static void onWiFiEvent(WiFiEvent_t event)
-	// We need to put activity indicators in FluidNC for IO to the Wifi AP/Station
-	// and (for them) perhaps add telnet indicator as well.  Fairly low priority
-	// for me at this point, though of interest.
-{
-	#if DEBUG_WIFI
-		g_debug("onWifiEvent(%d) %s",event,wifiEventName(event));
-	#endif
-	g_status.gWifiEvent(event);
-}
-
-
-void gStatus::initWifiEventHandler()
-	// register the wifiEvent handler
-{
-	WiFi.onEvent(onWiFiEvent);
-}
-
-
-uint8_t gStatus::getWifiStationMode()
-{
-	// 0 = none, 1=sta, 2=ap, 3=sta/ap
-	wifi_mode_t mode = WiFi.getMode();
-	return (uint8_t) mode;
-}
-const char *gStatus::getWifiName()
-{
-	wifi_mode_t mode = WiFi.getMode();
-	if (mode == 1)	// sta
-	{
-		static String s = WiFi.SSID().c_str();
-		return s.c_str();
-	}
-	else if (mode)	// 2 or 3 for AP and AP/STA mode
-	{
-		// show the actual, current AP SSID (possibly yaml driven)
-
-		static String s =  WiFi.softAPSSID();
-		return s.c_str();
-
-		// return WiFi.softAPgetHostname();		 returns "espressif"
-		// static String s =  WebUI::wifi_config.Hostname(); returns "fluidnc"
-		// return WiFi.getHostname();	returns "fluidnc"
-	}
-	else
-		return "";
-}
-
-const char *gStatus::getIPAddress()
-{
-	wifi_mode_t mode = WiFi.getMode();
-	if (mode == 1)	// sta
-		return WiFi.localIP().toString().c_str();
-	else if (mode)	// 2 or 3 for AP and AP/STA mode
-	{
-		IPAddress ip = WiFi.softAPIP();
-		static char buf[30];
-		sprintf(buf,"%d.%d.%d.%d",ip[0],ip[1],ip[2],ip[3]);
-		return buf;
-	}
-	else
-		return "";
-	IPAddress softAPIP();
-}
-
-
-//---------------------------------------------
-// updateStatus
-//---------------------------------------------
-
-
-void gStatus::updateStatus(bool inMeshLeveling /*=false*/)
-{
-	// wait until "started" (in a known state)
-	// before polling FluidNC
-
-	// SYSTEM STATE
-
-	m_sys_state = sys.state;
-	if (!m_started && m_sys_state != State::Sleep)
-	{
-		m_started = true;
-		// g_debug("gStatus started ..");
-	}
-	if (!m_started)
-		return;
-
-	// SDCARD STATE
-
-	SDCard *sdCard = config->_sdCard;
-	if (sdCard)
-	{
-		m_sdcard_state = sdCard->get_state();
-		if (m_sdcard_state == SDState::Busy)
-		{
-			m_active_filename = sdCard->filename();
-			m_file_pct = sdCard->percent_complete();
-		}
-	}
-
-	// JOB STATE
-
-	JobState job_state = JOB_IDLE;
-
-	if (inMeshLeveling)
-		job_state = JOB_MESHING;
-	else if (probeState == ProbeState::Active)
-		job_state = JOB_PROBING;
-    else if (m_sys_state == State::Homing)
-        job_state = JOB_HOMING;
-    else if (m_sys_state == State::Alarm)
-        job_state = JOB_ALARM;
-    else if (m_sys_state == State::Hold)
-        job_state = JOB_HOLD;
-    else if (m_sdcard_state == SDState::Busy)
-        job_state = JOB_BUSY;
-
-    // retain the previous state while cycling
-	// and returning to idle
-
-    if (job_state == JOB_IDLE &&
-        m_sys_state == State::Cycle)
-        job_state = m_job_state;
-
-	m_job_state = job_state;
-
-	// Grab the alaram state on job_state changes
-
-	static JobState last_job_state = JOB_NONE;
-	if (last_job_state != job_state)
-	{
-		last_job_state = job_state;
-		m_last_alarm = static_cast<uint8_t>(rtAlarm);
-		// g_debug("gStatus grabbed alarm=%d",m_last_alarm);
-	}
-
-	// POSITIONS
-
-	float *pos = get_mpos();
-	for (int i=0; i<G_NUM_AXIS; i++)
-	{
-		m_sys_pos[i] = motor_steps[i];
-		m_machine_pos[i] = pos[i];
-		m_work_pos[i] = pos[i];
-			// converted below
-	}
-	mpos_to_wpos(m_work_pos);
-		// DEPENDS on Yaml number of axes agreeing with our constant!!!!
-		// or BAD THINGS will happen
-
-}   // gStatus::updateStatus()
+//-------------------------------------------------------
+// An object that abstracts the state of FluidNC
+//-------------------------------------------------------
+
+#include "gStatus.h"
+#include "FluidDebug.h"
+#include "GcodeScan.h"
+#include "gAxes.h"
+
+#include <WiFi.h>
+
+#include <MotionControl.h>		    // FluidNC
+#include <Planner.h>		    	// FluidNC
+#include <Protocol.h>		      	// FluidNC
+#include <SDCard.h>                 // FluidNC
+#include <Serial.h>                 // FluidNC
+#include <Machine/MachineConfig.h>  // FluidNC
+
+
+#define DEBUG_WIFI  0
+
+static_assert(G_NUM_AXIS >= 3 && G_NUM_AXIS <= MAX_N_AXIS,"G_NUM_AXIS must be from 3 to MAX_N_AXIS");
+
+gStatus g_status;
+gJobCounters_t g_job_counters;
+
+
+
+//---------------------------------------------
+// wrappers
+//---------------------------------------------
+
+float gStatus::timePct()
+	// the byte position is recovered from the percentage, which
+	// is all that FluidNC's SDCard exposes
+{
+	if (m_sdcard_state != SDState::Busy || !g_gcode_scan.done())
+		return -1;
+	float total = g_gcode_scan.totalTime();
+	if (total <= 0)
+		return -1;
+	uint32_t offset = m_file_pct / 100.0 * g_gcode_scan.fileSize();
+	return 100.0 * g_gcode_scan.timeAt(offset) / total;
+}
+
+
+int32_t gStatus::getETA()
+{
+	float pct = timePct();
+	if (pct < 0)
+		return -1;
+	return (int32_t) (g_gcode_scan.totalTime() * (100.0 - pct) / 100.0 + 0.5);
+}
+
+
+float gStatus::getFeedRate()				{ return Stepper::get_realtime_rate(); }
+float gStatus::getAxisMaxTravel(int axis)	{ return config->_axes->_axis[axis]->_maxTravel; }
+float gStatus::getAxisPulloff(int axis)		{ return config->_axes->_axis[axis]->_motors[0]->_pulloff; }
+float gStatus::getAxisSeekRate(int axis)	{ return config->_axes->_axis[axis]->_homing->_seekRate; }     // the faster of the two
+float gStatus::getAxisFeedRate(int axis)	{ return config->_axes->_axis[axis]->_homing->_feedRate; }
+bool  gStatus::getProbeState()				{ return (bool) probeState; } // in MotionControl.cpp
+volatile float gStatus::getFeedOverride()	{ return rtFOverride; }	// in Protocol.cpp
+float gStatus::getRapidFeedOverride()		{ return rtROverride; }	// in Protocol.cpp
+float gStatus::getSpindleOverride()			{ return rtSOverride; }	// in Protocol.cpp
+
+
+//-----------------------------
+// SD probing
+//-----------------------------
+
+static StaticSemaphore_t sd_probe_buf;
+static SemaphoreHandle_t sd_probe_sem = xSemaphoreCreateBinaryStatic(&sd_probe_buf);
+	// given for each probe request, a binary semaphore
+	// so that requests made while probing are coalesced
+
+
+#if G_SD_DETECT_PIN >= 0
+	static void IRAM_ATTR sdDetectISR()
+	{
+		BaseType_t woken = pdFALSE;
+		xSemaphoreGiveFromISR(sd_probe_sem,&woken);
+		if (woken)
+			portYIELD_FROM_ISR();
+	}
+#endif
+
+
+SDState gStatus::getSDState(bool refresh/*=false*/)
+{
+	if (refresh && config->_sdCard)
+	{
+		startSDTask();
+		xSemaphoreGive(sd_probe_sem);
+	}
+	return m_sdcard_state;
+}
+
+
+void gStatus::startSDTask()
+	// from the first getSDState(true) or updateStatus()
+{
+	if (__atomic_exchange_n(&m_sd_task_started,1,__ATOMIC_RELAXED))
+		return;
+	TaskHandle_t task;
+	if (xTaskCreate(sdTask,"gStatusSD",4096,this,1,&task) != pdPASS)
+	{
+		g_error("gStatus: could not start SD task");
+		return;
+	}
+	#if G_SD_DETECT_PIN >= 0
+		pinMode(G_SD_DETECT_PIN,INPUT_PULLUP);
+		attachInterrupt(digitalPinToInterrupt(G_SD_DETECT_PIN),sdDetectISR,CHANGE);
+	#endif
+}
+
+
+void gStatus::sdTask(void *param)
+{
+	gStatus *self = (gStatus *) param;
+	while (true)
+	{
+		xSemaphoreTake(sd_probe_sem,portMAX_DELAY);
+		#if G_SD_DETECT_PIN >= 0
+			vTaskDelay(G_SD_SETTLE_MS / portTICK_PERIOD_MS);
+		#endif
+
+		// begin() leaves a running (Busy) job alone, and the
+		// read-ahead's file is not touched until it is closed
+
+		SDCard *sdCard = config->_sdCard;
+		#if SD_READ_AHEAD
+			if (g_sd_read_ahead.busy())
+				sdCard = NULL;
+		#endif
+		if (sdCard)
+			sdCard->begin(SDState::Idle);
+		self->m_sd_probed = 1;
+	}
+}
+
+
+//-----------------------------
+// job counters
+//-----------------------------
+
+void gStatus::resetJobCounters()
+{
+	memset(&g_job_counters,0,sizeof(g_job_counters));
+	g_job_counters.start_ms = millis();
+	m_planner_busy = false;
+	m_stall_counted = true;		// until the planner drains
+}
+
+
+void gStatus::countJob(JobState job_state, bool sd_started)
+	// Called by updateStatus() before m_job_state is updated.
+	// The planner draining, and whether the file moved on while it
+	// was empty, are only seen as often as updateStatus() is called.
+{
+	if (sd_started ||
+		(job_state == JOB_MESHING && m_job_state != JOB_MESHING))
+		resetJobCounters();
+
+	bool probing = probeState == ProbeState::Active;
+	if (probing && !m_probing)
+		gCount(&g_job_counters.probes);
+	m_probing = probing;
+
+	if (job_state != JOB_BUSY)
+	{
+		m_planner_busy = false;
+		m_stall_counted = true;
+		return;
+	}
+
+	bool planner_busy = plan_get_current_block() != NULL;
+	if (m_planner_busy && !planner_busy)
+	{
+		gCount(&g_job_counters.planner_empty);
+		m_empty_pct = m_file_pct;
+		m_stall_counted = false;
+	}
+	else if (!planner_busy && !m_stall_counted &&
+			 m_file_pct == m_empty_pct)
+	{
+		gCount(&g_job_counters.sd_stalls);
+		m_stall_counted = true;
+	}
+	m_planner_busy = planner_busy;
+}
+
+
+//-----------------------------
+// static name methods
+//-----------------------------
+
+const char *jobStateName(JobState job_state)
+{
+    switch (job_state)
+    {
+        case JOB_NONE    : return "";
+        case JOB_IDLE    : return "IDLE";
+        case JOB_BUSY    : return "BUSY";
+        case JOB_HOLD    : return "HOLD";
+        case JOB_HOMING  : return "HOMING";
+        case JOB_PROBING : return "PROBING";
+        case JOB_MESHING : return "MESHING";
+        case JOB_ALARM   : return "ALARM";
+    }
+    return "UNKNOWN_JOB_STATE";
+}
+
+
+const char *sysStateName(State state)
+{
+	switch (state)
+	{
+		case State::Idle       : return "Idle";
+		case State::Alarm      : return "Alarm";
+		case State::CheckMode  : return "CheckMode";
+		case State::Homing     : return "Homing";
+		case State::Cycle      : return "Cycle";
+		case State::Hold       : return "Hold";
+		case State::Jog        : return "Jog";
+		case State::SafetyDoor : return "SafetyDoor";
+		case State::Sleep      : return "Sleep";
+	}
+	return "UNKNOWN_STATE";
+}
+
+
+const char *sdStateName(SDState state)
+	// BusyPrinting is same as Busy
+{
+	switch (state)
+	{
+		case SDState::Idle          : return "Idle";
+		case SDState::NotPresent    : return "NotPresent";
+		case SDState::Busy  		  : return "Busy";
+		case SDState::BusyUploading : return "BusyUploading";
+		case SDState::BusyParsing   : return "BusyParsing";
+	}
+	return "UNKNOWN_SD_STATE";
+}
+
+
+
+//-------------------------------
+// Wifi
+//-------------------------------
+
+#if DEBUG_WIFI
+	static const char *wifiEventName(WiFiEvent_t event)
+	{
+		switch (event)
+		{
+			case SYSTEM_EVENT_WIFI_READY	        : return "WIFI_READY";
+			case SYSTEM_EVENT_SCAN_DONE	            : return "SCAN_DONE";
+			case SYSTEM_EVENT_STA_START	            : return "STA_START";
+			case SYSTEM_EVENT_STA_STOP	            : return "STA_STOP";
+			case SYSTEM_EVENT_STA_CONNECTED	        : return "STA_CONNECTED";
+			case SYSTEM_EVENT_STA_DISCONNECTED	    : return "STA_DISCONNECTED";
+			case SYSTEM_EVENT_STA_AUTHMODE_CHANGE	: return "STA_AUTHMODE_CHANGE";
+			case SYSTEM_EVENT_STA_GOT_IP	        : return "STA_GOT_IP";
+			case SYSTEM_EVENT_STA_LOST_IP	        : return "STA_LOST_IP";
+			case SYSTEM_EVENT_STA_WPS_ER_SUCCESS	: return "STA_WPS_ER_SUCCESS";
+			case SYSTEM_EVENT_STA_WPS_ER_FAILED	    : return "STA_WPS_ER_FAILED";
+			case SYSTEM_EVENT_STA_WPS_ER_TIMEOUT	: return "STA_WPS_ER_TIMEOUT";
+			case SYSTEM_EVENT_STA_WPS_ER_PIN	    : return "STA_WPS_ER_PIN";
+			case SYSTEM_EVENT_AP_START	            : return "AP_START";
+			case SYSTEM_EVENT_AP_STOP	            : return "AP_STOP";
+			case SYSTEM_EVENT_AP_STACONNECTED	    : return "AP_STACONNECTED";
+			case SYSTEM_EVENT_AP_STADISCONNECTED	: return "AP_STADISCONNECTED";
+			case SYSTEM_EVENT_AP_STAIPASSIGNED	    : return "AP_STAIPASSIGNED";
+			case SYSTEM_EVENT_AP_PROBEREQRECVED	    : return "AP_PROBEREQRECVED";
+			case SYSTEM_EVENT_GOT_IP6	            : return "GOT_IP6";
+			case SYSTEM_EVENT_ETH_START	            : return "ETH_START";
+			case SYSTEM_EVENT_ETH_STOP	            : return "ETH_STOP";
+			case SYSTEM_EVENT_ETH_CONNECTED         : return "ETH_CONNECTED	ESP32";
+			case SYSTEM_EVENT_ETH_DISCONNECTED	    : return "ETH_DISCONNECTED";
+			case SYSTEM_EVENT_ETH_GOT_IP	        : return "ETH_GOT_IP";
+		}
+		return "UNKNOWN_WIFI_EVENT";
+	}
+#endif
+
+
+void gStatus::gWifiEvent(uint16_t event)
+{
+	uint8_t old_state = m_wifi_state;
+	switch (static_cast<WiFiEvent_t>(event))
+	{
+		case SYSTEM_EVENT_STA_DISCONNECTED         :    // ESP32 station disconnected from AP
+		case SYSTEM_EVENT_AP_STADISCONNECTED       :    // a station disconnected from ESP32 soft-AP
+			m_wifi_state = IND_STATE_ENABLED;
+			break;
+
+		// case SYSTEM_EVENT_SCAN_DONE                :    // ESP32 finish scanning AP
+		case SYSTEM_EVENT_AP_START                 :    // ESP32 soft-AP start
+		case SYSTEM_EVENT_STA_START                :    // ESP32 station start
+			m_wifi_state = IND_STATE_ACTIVE;
+			break;
+
+		case SYSTEM_EVENT_WIFI_READY 			   :
+		case SYSTEM_EVENT_AP_STACONNECTED          :    // a station connected to ESP32 soft-AP
+		case SYSTEM_EVENT_STA_GOT_IP               :    // ESP32 station got IP from connected AP
+		case SYSTEM_EVENT_STA_CONNECTED            :    // ESP32 station connected to AP
+		case SYSTEM_EVENT_STA_WPS_ER_SUCCESS       :    // ESP32 station wps succeeds in enrollee mode
+			m_wifi_state = IND_STATE_READY;
+			break;
+
+		case SYSTEM_EVENT_AP_STOP                  :    // ESP32 soft-AP stop
+		// case SYSTEM_EVENT_STA_STOP                 :    // ESP32 station stop
+		case SYSTEM_EVENT_STA_LOST_IP              :    // ESP32 station lost IP and the IP is reset to 0
+		case SYSTEM_EVENT_STA_WPS_ER_FAILED        :    // ESP32 station wps fails in enrollee mode
+		case SYSTEM_EVENT_STA_WPS_ER_TIMEOUT       :    // ESP32 station wps timeout in enrollee mode
+		case SYSTEM_EVENT_STA_WPS_ER_PIN           :    // ESP32 station wps pin code in enrollee mode
+			m_wifi_state = IND_STATE_ERROR;
+			break;
+
+		// case SYSTEM_EVENT_STA_AUTHMODE_CHANGE      :    // the auth mode of AP connected by ESP32 station changed
+		// case SYSTEM_EVENT_AP_STAIPASSIGNED         :    // ESP32 soft-AP assign an IP to a connected station
+		// case SYSTEM_EVENT_AP_PROBEREQRECVED        :    // Receive probe request packet in soft-AP interface
+		// case SYSTEM_EVENT_GOT_IP6                  :    // ESP32 station or ap or ethernet interface v6IP addr is preferred
+		// case SYSTEM_EVENT_ETH_START                :    // ESP32 ethernet start
+		// case SYSTEM_EVENT_ETH_STOP                 :    // ESP32 ethernet stop
+		// case SYSTEM_EVENT_ETH_CONNECTED            :    // ESP32 ethernet phy link up
+		// case SYSTEM_EVENT_ETH_DISCONNECTED         :    // ESP32 ethernet phy link down
+		// case SYSTEM_EVENT_ETH_GOT_IP               :    // ESP32 ethernet got IP from connected AP
+		// case SYSTEM_EVENT_MAX
+	}
+	if (m_wifi_state != old_state)
+		addChanges(G_CHANGE_WIFI);
+	refreshNetworkInfo();
+}
+
+
+static void onWiFiEvent(WiFiEvent_t event)
+	// We need to put activity indicators in FluidNC for IO to the Wifi AP/Station
+	// and (for them) perhaps add telnet indicator as well.  Fairly low priority
+	// for me at this point, though of interest.
+{
+	#if DEBUG_WIFI
+		g_debug("onWifiEvent(%d) %s",event,wifiEventName(event));
+	#endif
+	g_status.gWifiEvent(event);
+}
+
+
+void gStatus::initWifiEventHandler()
+	// register the wifiEvent handler
+{
+	refreshNetworkInfo();
+	WiFi.onEvent(onWiFiEvent);
+}
+
+
+gStatus::networkInfo_t gStatus::s_network[2];
+volatile uint8_t gStatus::s_network_index = 0;
+
+static StaticSemaphore_t network_mutex_buf;
+static SemaphoreHandle_t network_mutex = xSemaphoreCreateMutexStatic(&network_mutex_buf);
+	// initWifiEventHandler() and the wifi task can both refresh
+
+
+void gStatus::refreshNetworkInfo()
+	// Called from the wifi task on events. Fills in the buffer
+	// that is not in use, and then switches to it.  The writers
+	// are serialized, so the buffer being read is only overwritten
+	// by the refresh after the next one.
+{
+	xSemaphoreTake(network_mutex,portMAX_DELAY);
+
+	uint8_t index = s_network_index ^ 1;
+	networkInfo_t *info = &s_network[index];
+
+	wifi_mode_t mode = WiFi.getMode();
+	IPAddress ip;
+	memset(info,0,sizeof(networkInfo_t));
+	info->mode = (uint8_t) mode;
+
+	if (mode == 1)	// sta
+	{
+		strncpy(info->name,WiFi.SSID().c_str(),sizeof(info->name)-1);
+		ip = WiFi.localIP();
+	}
+	else if (mode)	// 2 or 3 for AP and AP/STA mode
+	{
+		// show the actual, current AP SSID (possibly yaml driven)
+
+		strncpy(info->name,WiFi.softAPSSID().c_str(),sizeof(info->name)-1);
+		ip = WiFi.softAPIP();
+
+		// WiFi.softAPgetHostname() returns "espressif"
+		// WebUI::wifi_config.Hostname() returns "fluidnc"
+		// WiFi.getHostname() returns "fluidnc"
+	}
+	info->name[sizeof(info->name)-1] = 0;
+	if (mode)
+		sprintf(info->ip_address,"%d.%d.%d.%d",ip[0],ip[1],ip[2],ip[3]);
+
+	if (memcmp(info,&s_network[index^1],sizeof(networkInfo_t)))
+	{
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		s_network_index = index;
+		addChanges(G_CHANGE_WIFI);
+	}
+
+	xSemaphoreGive(network_mutex);
+}
+
+
+uint8_t gStatus::getWifiStationMode()
+{
+	return s_network[s_network_index].mode;
+}
+
+const char *gStatus::getWifiName()
+{
+	return s_network[s_network_index].name;
+}
+
+const char *gStatus::getIPAddress()
+{
+	return s_network[s_network_index].ip_address;
+}
+
+
+//---------------------------------------------
+// change notification
+//---------------------------------------------
+
+int gStatus::subscribe(uint32_t mask, gStatusCallback callback /*=NULL*/, void *param /*=NULL*/)
+{
+	for (int i=0; i<G_MAX_SUBSCRIBERS; i++)
+	{
+		subscriber_t *sub = &m_subscribers[i];
+		if (!sub->mask)
+		{
+			sub->callback = callback;
+			sub->param = param;
+			sub->pending = 0;
+			sub->mask = mask;
+			return i;
+		}
+	}
+	g_error("gStatus::subscribe() too many subscribers");
+	return -1;
+}
+
+
+void gStatus::unsubscribe(int id)
+{
+	if (id >= 0 && id < G_MAX_SUBSCRIBERS)
+		m_subscribers[id].mask = 0;
+}
+
+
+uint32_t gStatus::takeChanges(int id)
+{
+	if (id < 0 || id >= G_MAX_SUBSCRIBERS)
+		return 0;
+	return __atomic_exchange_n(&m_subscribers[id].pending,0,__ATOMIC_RELAXED);
+}
+
+
+uint32_t gStatus::positionChanges()
+	// A position change is only reported when some axis has moved
+	// more than the threshold since the last one was reported.
+{
+	for (int i=0; i<G_NUM_AXIS; i++)
+	{
+		if (fabs(m_machine_pos[i] - m_notified_pos[0][i]) > m_position_threshold ||
+			fabs(m_work_pos[i] - m_notified_pos[1][i]) > m_position_threshold)
+		{
+			memcpy(m_notified_pos[0],m_machine_pos,sizeof(m_machine_pos));
+			memcpy(m_notified_pos[1],m_work_pos,sizeof(m_work_pos));
+			return G_CHANGE_POSITION;
+		}
+	}
+	return 0;
+}
+
+
+void gStatus::notify(uint32_t changes)
+{
+	changes |= __atomic_exchange_n(&m_changes,0,__ATOMIC_RELAXED);
+	if (!changes)
+		return;
+
+	for (int i=0; i<G_MAX_SUBSCRIBERS; i++)
+	{
+		subscriber_t *sub = &m_subscribers[i];
+		uint32_t sub_changes = changes & sub->mask;
+		if (!sub_changes)
+			continue;
+		if (sub->callback)
+			sub->callback(sub_changes,sub->param);
+		else
+			__atomic_fetch_or(&sub->pending,sub_changes,__ATOMIC_RELAXED);
+	}
+}
+
+
+//---------------------------------------------
+// snapshot
+//---------------------------------------------
+// One writer, updateStatus(), which fills in the snapshot after the last
+// published one, under its own seqlock, and then publishes it.  Readers
+// copy the last published one, so they never wait for the writer to
+// finish (which could be a lower priority task on the same core), and
+// only retry if it has since lapped all G_SNAPSHOTS of them.
+
+void gStatus::publish()
+{
+	uint32_t last = m_snapshot_idx;
+	uint32_t idx = (last + 1) % G_SNAPSHOTS;
+	gStatusSnapshot_t *snap = &m_snapshot[idx];
+
+	uint32_t lock = m_snapshot_lock[idx];
+	m_snapshot_lock[idx] = lock + 1;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	snap->seq = m_snapshot[last].seq + 1;
+	snap->job_state = m_job_state;
+	snap->sys_state = m_sys_state;
+	snap->sd_state = m_sdcard_state;
+	snap->last_alarm = m_last_alarm;
+	snap->wifi_state = m_wifi_state;
+	snap->file_pct = m_file_pct;
+	memcpy(snap->sys_pos,m_sys_pos,sizeof(m_sys_pos));
+	memcpy(snap->machine_pos,m_machine_pos,sizeof(m_machine_pos));
+	memcpy(snap->work_pos,m_work_pos,sizeof(m_work_pos));
+	snap->mesh_z = m_mesh_z;
+	snap->live_z = m_live_z;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	m_snapshot_lock[idx] = lock + 2;
+	__atomic_store_n(&m_snapshot_idx,idx,__ATOMIC_RELEASE);
+}
+
+
+void gStatus::getSnapshot(gStatusSnapshot_t *snapshot)
+{
+	while (1)
+	{
+		uint32_t idx = __atomic_load_n(&m_snapshot_idx,__ATOMIC_ACQUIRE);
+		uint32_t lock = m_snapshot_lock[idx];
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (!(lock & 1))
+		{
+			memcpy(snapshot,(const void *) &m_snapshot[idx],sizeof(gStatusSnapshot_t));
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if (m_snapshot_lock[idx] == lock)
+				return;
+		}
+	}
+}
+
+
+//---------------------------------------------
+// position history
+//---------------------------------------------
+// One writer, updateStatus(). m_history_writing is bumped before a
+// slot is overwritten, and m_history_count after, so a reader knows
+// a copy of sample n is good if m_history_writing is still no more
+// than n + G_HISTORY_SIZE after making it.
+
+void gStatus::addHistory()
+{
+	uint32_t now = millis();
+	if (!m_history_ms || now - m_history_last < m_history_ms)
+		return;
+	m_history_last = now;
+
+	uint32_t count = m_history_count;
+	m_history_writing = count + 1;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	gHistorySample_t *sample = &m_history[count & (G_HISTORY_SIZE-1)];
+	sample->ms = now;
+	sample->job_state = m_job_state;
+	memcpy(sample->machine_pos,m_machine_pos,sizeof(m_machine_pos));
+	memcpy(sample->work_pos,m_work_pos,sizeof(m_work_pos));
+	sample->mesh_z = m_mesh_z;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	m_history_count = count + 1;
+}
+
+
+static void minMax(float *lo, float *hi, float value)
+{
+	if (value < *lo) *lo = value;
+	if (value > *hi) *hi = value;
+}
+
+
+int gStatus::getHistory(gHistorySample_t *mins, gHistorySample_t *maxs, int buckets, int num_samples /*=G_HISTORY_SIZE*/)
+{
+	uint32_t count = m_history_count;
+	if (num_samples > G_HISTORY_SIZE - 1)
+		num_samples = G_HISTORY_SIZE - 1;
+		// leave room for the one being written
+	if ((uint32_t) num_samples > count)
+		num_samples = count;
+	if (buckets <= 0 || num_samples <= 0)
+		return 0;
+
+	int per_bucket = (num_samples + buckets - 1) / buckets;
+	int bucket = -1;
+	int in_bucket = per_bucket;
+	uint32_t first = count - num_samples;
+
+	for (uint32_t n=first; n<count; n++)
+	{
+		gHistorySample_t sample = m_history[n & (G_HISTORY_SIZE-1)];
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (m_history_writing - n > G_HISTORY_SIZE)
+			continue;	// overwritten while we were copying it
+
+		if (in_bucket == per_bucket)
+		{
+			bucket++;
+			in_bucket = 0;
+			mins[bucket] = sample;
+			maxs[bucket] = sample;
+		}
+		in_bucket++;
+
+		gHistorySample_t *lo = &mins[bucket];
+		gHistorySample_t *hi = &maxs[bucket];
+		for (int i=0; i<G_NUM_AXIS; i++)
+		{
+			minMax(&lo->machine_pos[i],&hi->machine_pos[i],sample.machine_pos[i]);
+			minMax(&lo->work_pos[i],&hi->work_pos[i],sample.work_pos[i]);
+		}
+		minMax(&lo->mesh_z,&hi->mesh_z,sample.mesh_z);
+		lo->ms = hi->ms = sample.ms;
+		lo->job_state = hi->job_state = sample.job_state;
+	}
+	return bucket + 1;
+}
+
+
+//-----------------------------
+// state transitions
+//-----------------------------
+
+void gStatus::addTransition(uint32_t now, uint32_t latency)
+{
+	uint32_t count = m_transition_count;
+	m_transition_writing = count + 1;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	gTransition_t *transition = &m_transitions[count & (G_TRANSITION_SIZE-1)];
+	transition->ms = now;
+	transition->latency_ms = latency > 0xffff ? 0xffff : latency;
+	transition->job_state = m_job_state;
+	transition->sys_state = m_sys_state;
+	transition->alarm = m_last_alarm;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	m_transition_count = count + 1;
+}
+
+
+int gStatus::getTransitions(gTransition_t *transitions, int max)
+{
+	uint32_t count = m_transition_count;
+	if (max > G_TRANSITION_SIZE - 1)
+		max = G_TRANSITION_SIZE - 1;
+	if ((uint32_t) max > count)
+		max = count;
+
+	int num = 0;
+	for (uint32_t n=count-max; n<count; n++)
+	{
+		transitions[num] = m_transitions[n & (G_TRANSITION_SIZE-1)];
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (m_transition_writing - n > G_TRANSITION_SIZE)
+			continue;	// overwritten while we were copying it
+		num++;
+	}
+	return num;
+}
+
+
+void gStatus::addToHistogram(gHistogram_t which, uint32_t ms)
+{
+	int bucket = 0;
+	while (ms && bucket < G_HISTOGRAM_BUCKETS-1)
+	{
+		ms >>= 1;
+		bucket++;
+	}
+	m_histograms[which][bucket]++;
+}
+
+
+void gStatus::getHistogram(gHistogram_t which, uint32_t *counts)
+{
+	for (int i=0; i<G_HISTOGRAM_BUCKETS; i++)
+		counts[i] = m_histograms[which][i];
+}
+
+
+void gStatus::clearHistograms()
+{
+	for (int i=0; i<G_NUM_HISTOGRAMS; i++)
+		for (int j=0; j<G_HISTOGRAM_BUCKETS; j++)
+			m_histograms[i][j] = 0;
+}
+
+
+//---------------------------------------------
+// binary status frames
+//---------------------------------------------
+// encodeFrame() and decodeFrame() are in gStatusFrame.cpp
+
+static int16_t microns(float mm)
+{
+	float um = roundf(mm * 1000.0);
+	return um > INT16_MAX ? INT16_MAX : um < INT16_MIN ? INT16_MIN : (int16_t) um;
+}
+
+
+void gStatus::getFrame(gStatusFrame_t *frame)
+{
+	gStatusSnapshot_t snap;
+	getSnapshot(&snap);
+
+	frame->ms = millis();
+	frame->job_state = snap.job_state;
+	frame->sys_state = static_cast<uint8_t>(snap.sys_state);
+	frame->sd_state = static_cast<uint8_t>(snap.sd_state);
+	frame->alarm = snap.last_alarm;
+	frame->wifi_state = snap.wifi_state;
+	frame->feed_override = getFeedOverride();
+	frame->rapid_override = getRapidFeedOverride();
+	frame->spindle_override = getSpindleOverride();
+	frame->file_pct = snap.sd_state == SDState::Busy ? (uint16_t) (snap.file_pct * 100.0) : 0;
+	memcpy(frame->steps,snap.sys_pos,sizeof(frame->steps));
+	frame->live_z = microns(snap.live_z);
+	frame->mesh_z = microns(snap.mesh_z);
+}
+
+
+//---------------------------------------------
+// updateStatus
+//---------------------------------------------
+
+
+void gStatus::updateStatus(bool inMeshLeveling /*=false*/, float meshZ /*=0*/, float liveZ /*=0*/)
+{
+	// wait until "started" (in a known state)
+	// before polling FluidNC
+
+	uint32_t changes = 0;
+	uint32_t now = millis();
+	uint32_t latency = m_polled ? now - m_poll_ms : 0;
+	bool first_poll = !m_polled;
+	m_poll_ms = now;
+	m_polled = true;
+
+	// SYSTEM STATE
+
+	bool sys_changed = m_sys_state != sys.state;
+	if (sys_changed)
+	{
+		changes |= G_CHANGE_SYS_STATE;
+		if (!first_poll)
+			addToHistogram(G_HISTOGRAM_LATENCY,latency);
+	}
+	m_sys_state = sys.state;
+	if (!m_started && m_sys_state != State::Sleep)
+	{
+		m_started = true;
+		// g_debug("gStatus started ..");
+		if (config->_axes->_numberAxis < G_NUM_AXIS)
+			g_error("gStatus: G_NUM_AXIS(%d) is more than the %d axes in the yaml",
+				G_NUM_AXIS,config->_axes->_numberAxis);
+	}
+	if (!m_started)
+		return;
+
+	// SDCARD STATE
+
+	bool sd_started = false;
+	SDCard *sdCard = config->_sdCard;
+	if (sdCard)
+	{
+		startSDTask();
+		if (__atomic_exchange_n(&m_sd_probed,0,__ATOMIC_RELAXED))
+			changes |= G_CHANGE_SD_STATE;
+
+		SDState sd_state = sdCard->get_state();
+		sd_started = sd_state == SDState::Busy && m_sdcard_state != SDState::Busy;
+		if (m_sdcard_state != sd_state)
+		{
+			changes |= G_CHANGE_SD_STATE;
+			if (m_sdcard_state == SDState::Busy)
+				g_gcode_scan.abort();	// the estimate was for that job
+		}
+		m_sdcard_state = sd_state;
+		if (m_sdcard_state == SDState::Busy)
+		{
+			const char *filename = sdCard->filename();
+			if (m_active_filename != filename)
+				changes |= G_CHANGE_FILE;
+			m_active_filename = filename;
+			m_file_pct = sdCard->percent_complete();
+			if (fabs(m_file_pct - m_notified_pct) >= G_FILE_PCT_THRESHOLD)
+			{
+				m_notified_pct = m_file_pct;
+				changes |= G_CHANGE_FILE;
+			}
+		}
+	}
+
+	// JOB STATE
+
+	JobState job_state = JOB_IDLE;
+
+	if (inMeshLeveling)
+		job_state = JOB_MESHING;
+	else if (probeState == ProbeState::Active)
+		job_state = JOB_PROBING;
+    else if (m_sys_state == State::Homing)
+        job_state = JOB_HOMING;
+    else if (m_sys_state == State::Alarm)
+        job_state = JOB_ALARM;
+    else if (m_sys_state == State::Hold)
+        job_state = JOB_HOLD;
+    else if (m_sdcard_state == SDState::Busy)
+        job_state = JOB_BUSY;
+
+    // retain the previous state while cycling
+	// and returning to idle
+
+    if (job_state == JOB_IDLE &&
+        m_sys_state == State::Cycle)
+        job_state = m_job_state;
+
+	countJob(job_state,sd_started);
+
+	// Grab the alaram state on job_state changes,
+	// and time the HOLD and PROBING states
+
+	bool job_changed = m_job_state != job_state;
+	if (job_changed)
+	{
+		changes |= G_CHANGE_JOB_STATE;
+		if (m_job_state == JOB_HOLD)
+			addToHistogram(G_HISTOGRAM_HOLD,now - m_job_state_ms);
+		else if (m_job_state == JOB_PROBING)
+			addToHistogram(G_HISTOGRAM_PROBING,now - m_job_state_ms);
+		m_job_state_ms = now;
+
+		uint8_t alarm = static_cast<uint8_t>(rtAlarm);
+		if (m_last_alarm != alarm)
+			changes |= G_CHANGE_ALARM;
+		m_last_alarm = alarm;
+		// g_debug("gStatus grabbed alarm=%d",m_last_alarm);
+	}
+	m_job_state = job_state;
+
+	if (job_changed || sys_changed)
+		addTransition(now,latency);
+
+	// POSITIONS
+
+	// mpos_to_wpos() converts as many axes as the yaml has,
+	// so it is given a full sized copy, not m_work_pos
+
+	float work_pos[MAX_N_AXIS];
+	float *pos = get_mpos();
+	axesCopy<G_NUM_AXIS>(m_sys_pos,motor_steps);
+	axesCopy<G_NUM_AXIS>(m_machine_pos,pos);
+	memcpy(work_pos,pos,sizeof(work_pos));
+	mpos_to_wpos(work_pos);
+	axesCopy<G_NUM_AXIS>(m_work_pos,work_pos);
+
+	m_mesh_z = meshZ;
+	m_live_z = liveZ;
+
+	publish();
+	addHistory();
+
+	changes |= positionChanges();
+	notify(changes);
+
+}   // gStatus::updateStatus()
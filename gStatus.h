@@ -1,118 +1,452 @@
-//-------------------------------------------------------
-// An object that abstracts the state of FluidNC
-//-------------------------------------------------------
-// Consolidates disperse FluidNC state machines into a higher
-// level abstraction of a "job" and provides a single API to
-// a number of FluidNC state variables, minimimizing hodgepodge
-// including of FluidNC H files.
-
-#pragma once
-
-#include <Arduino.h>
-#include <FluidTypes.h>
-
-
-#define G_NUM_AXIS      3
-    // this object currently only supports
-    // a simple three axis machine
-
-// indicator states for SDCard and Wifi
-
-typedef uint8_t indicatorState_t;
-
-#define IND_STATE_NONE         0x00
-#define IND_STATE_ENABLED      0x01
-#define IND_STATE_READY        0x02
-#define IND_STATE_ACTIVE       0x04
-#define IND_STATE_ERROR        0x08
-#define IND_STATE_ALL          0x0f
-
-
-// the essential job state abstraction
-
-typedef enum JobState
-{
-    JOB_NONE,
-    JOB_IDLE,
-    JOB_BUSY,
-    JOB_HOLD,
-    JOB_HOMING,
-    JOB_PROBING,
-    JOB_MESHING,
-    JOB_ALARM
-};
-
-
-class gStatus
-{
-public:
-
-    gStatus()   {}
-
-    void initWifiEventHandler();
-    void gWifiEvent(uint16_t event);
-
-    void updateStatus(bool inMeshLeveling=false);
-        // Called by client to update state of this object in a loop of some sort.
-        // If you are using the mesh, pass in "inLeveling" state in order to c
-        // correctly set the JobState
-
-    JobState getJobState()          { return m_job_state; }
-    uint8_t getLastAlarm()          { return m_last_alarm; }
-        // alarm number is grabbed when job state changes so it can be displayed later
-
-    State getSysState()             { return m_sys_state; }
-    SDState getSDState(bool refresh=false);
-
-    uint8_t getWifiState()          { return m_wifi_state; }
-    static uint8_t getWifiStationMode();
-    static const char *getWifiName();
-        // return name of current STATION or ACCESS_POINT when connected
-    static const char *getIPAddress();
-        // return current IP address when connected
-
-    const char* getActiveFilename() { return m_active_filename; }
-    float filePct()                 { return m_file_pct; }
-
-    // wrappers to FluidNC global variables
-
-    static float getFeedRate();
-    static float getAxisMaxTravel(int axis);
-    static float getAxisPulloff(int axis);
-    static float getAxisSeekRate(int axis);     // the faster of the two
-    static float getAxisFeedRate(int axis);
-    static volatile float getFeedOverride();
-    static float getRapidFeedOverride();
-    static float getSpindleOverride();
-    static bool  getProbeState();
-
-    // public denormalized FluidNC state variables
-
-    int32_t m_sys_pos[G_NUM_AXIS];
-    float m_machine_pos[G_NUM_AXIS];
-    float m_work_pos[G_NUM_AXIS];
-
-protected:
-
-    bool m_started = false;
-
-    // state variables
-
-    JobState  m_job_state = JOB_NONE;
-    State m_sys_state = State::Sleep;
-    SDState m_sdcard_state = SDState::NotPresent;
-
-    uint8_t m_last_alarm = 0;
-    uint8_t m_wifi_state = 0;
-
-    const char *m_active_filename;
-    float m_file_pct;
-
-};  // class gStatus
-
-
-extern gStatus g_status;
-
-extern const char *sysStateName(State state);
-extern const char *sdStateName(SDState state);
-extern const char *jobStateName(JobState job_state);
+//-------------------------------------------------------
+// An object that abstracts the state of FluidNC
+//-------------------------------------------------------
+// Consolidates disperse FluidNC state machines into a higher
+// level abstraction of a "job" and provides a single API to
+// a number of FluidNC state variables, minimimizing hodgepodge
+// including of FluidNC H files.
+
+#pragma once
+
+#include <Arduino.h>
+#include <FluidTypes.h>
+
+#include "gCounters.h"
+#include "SDReadAhead.h"
+
+
+#ifndef G_NUM_AXIS
+    #define G_NUM_AXIS  3
+#endif
+    // The number of axes in the positions, snapshots, history and
+    // frames, fixed at compile time. It may be less than the number
+    // in the yaml (i.e. 3 for an XYZA machine that only shows XYZ),
+    // but not more.
+
+// indicator states for SDCard and Wifi
+
+typedef uint8_t indicatorState_t;
+
+#define IND_STATE_NONE         0x00
+#define IND_STATE_ENABLED      0x01
+#define IND_STATE_READY        0x02
+#define IND_STATE_ACTIVE       0x04
+#define IND_STATE_ERROR        0x08
+#define IND_STATE_ALL          0x0f
+
+
+// the essential job state abstraction
+
+typedef enum JobState
+{
+    JOB_NONE,
+    JOB_IDLE,
+    JOB_BUSY,
+    JOB_HOLD,
+    JOB_HOMING,
+    JOB_PROBING,
+    JOB_MESHING,
+    JOB_ALARM
+};
+
+
+// change bits passed to subscribers
+
+#define G_CHANGE_JOB_STATE      0x0001
+#define G_CHANGE_SYS_STATE      0x0002
+#define G_CHANGE_ALARM          0x0004
+#define G_CHANGE_SD_STATE       0x0008
+#define G_CHANGE_FILE           0x0010      // active filename or percent
+#define G_CHANGE_POSITION       0x0020      // beyond the position threshold
+#define G_CHANGE_WIFI           0x0040
+#define G_CHANGE_ALL            0x007f
+
+#define G_MAX_SUBSCRIBERS       4
+#define G_POSITION_THRESHOLD    0.01        // default mm
+#define G_FILE_PCT_THRESHOLD    0.1         // percent
+
+typedef void (*gStatusCallback)(uint32_t changes, void *param);
+
+
+// SD card probing
+// SDCard::begin() can take hundreds of ms to mount a card, so it is
+// only called from a background task, when getSDState(true) asks for
+// it or, if there is a card detect pin, when a card goes in or out.
+
+#ifndef G_SD_DETECT_PIN
+    #define G_SD_DETECT_PIN     -1          // gpio, or -1 for none
+#endif
+#define G_SD_SETTLE_MS          100         // after a card detect edge
+
+
+// position history
+
+#ifndef G_HISTORY_SIZE
+    #define G_HISTORY_SIZE      256         // samples, power of two
+#endif
+#define G_HISTORY_MS            100         // default sample interval
+
+typedef struct
+{
+    uint32_t    ms;             // millis()
+    JobState    job_state;
+    float       machine_pos[G_NUM_AXIS];
+    float       work_pos[G_NUM_AXIS];
+    float       mesh_z;         // the mesh z offset in effect
+} gHistorySample_t;
+
+
+// state transitions
+// updateStatus() only polls FluidNC, so a sys.state change is seen
+// some time after it happens, at most the time since the previous
+// poll, which is recorded as its latency.  The histograms have log2
+// buckets of ms: bucket 0 is 0ms, bucket n is 2^(n-1) to 2^n-1 ms,
+// and the last bucket is everything longer.
+
+#ifndef G_TRANSITION_SIZE
+    #define G_TRANSITION_SIZE   32          // transitions, power of two
+#endif
+#define G_HISTOGRAM_BUCKETS     16
+
+typedef struct
+{
+    uint32_t    ms;             // millis() when it was seen
+    uint16_t    latency_ms;     // at most this long after it happened
+    JobState    job_state;
+    State       sys_state;
+    uint8_t     alarm;          // the last alarm, latched on job state changes
+} gTransition_t;
+
+typedef enum
+{
+    G_HISTOGRAM_LATENCY,        // sys.state change to updateStatus() seeing it
+    G_HISTOGRAM_HOLD,           // time in JOB_HOLD
+    G_HISTOGRAM_PROBING,        // time in JOB_PROBING
+    G_NUM_HISTOGRAMS
+} gHistogram_t;
+
+
+// a consistent copy of the state, for other tasks
+
+#define G_SNAPSHOTS             3           // published in rotation
+
+typedef struct
+{
+    uint32_t    seq;            // incremented by each updateStatus()
+    JobState    job_state;
+    State       sys_state;
+    SDState     sd_state;
+    uint8_t     last_alarm;
+    uint8_t     wifi_state;
+    float       file_pct;
+    int32_t     sys_pos[G_NUM_AXIS];
+    float       machine_pos[G_NUM_AXIS];
+    float       work_pos[G_NUM_AXIS];
+    float       mesh_z;
+    float       live_z;
+} gStatusSnapshot_t;
+
+
+// binary status frames
+//
+// A frame is: 0xA5, 'F' (full) or 'D' (delta), an 8 bit sequence number,
+// a 16 bit little endian mask of the fields that follow, and then the
+// fields in bit order.  In a full frame every field is present with its
+// fixed size.  In a delta frame only the fields that changed since the
+// previous frame are present, and the ms, steps, and mesh z are sent as
+// zigzag varint differences. Decoders should ask for a full frame if the
+// sequence number of a delta frame is not one more than the last one.
+
+#define G_FRAME_MAGIC           0xA5
+#define G_FRAME_FULL            'F'
+#define G_FRAME_DELTA           'D'
+#define G_FRAME_HEADER          5
+#define G_FRAME_FULL_SIZE       (G_FRAME_HEADER + 18 + 4 * G_NUM_AXIS)
+#define G_FRAME_MAX             (G_FRAME_HEADER + 20 + 5 * G_NUM_AXIS)
+    // the biggest a frame (full or delta) can be
+
+#define G_FRAME_MS              0x0001      // u32
+#define G_FRAME_JOB_STATE       0x0002      // u8
+#define G_FRAME_SYS_STATE       0x0004      // u8
+#define G_FRAME_SD_STATE        0x0008      // u8
+#define G_FRAME_ALARM           0x0010      // u8
+#define G_FRAME_WIFI            0x0020      // u8
+#define G_FRAME_OVERRIDES       0x0040      // u8 feed, rapid, spindle percent
+#define G_FRAME_FILE_PCT        0x0080      // u16 hundredths of a percent
+#define G_FRAME_STEPS           0x0100      // i32 per axis
+#define G_FRAME_LIVE_Z          0x0200      // i16 microns
+#define G_FRAME_MESH_Z          0x0400      // i16 microns
+#define G_FRAME_ALL             0x07ff
+
+typedef struct
+{
+    uint8_t     seq;
+    uint32_t    ms;
+    uint8_t     job_state;
+    uint8_t     sys_state;
+    uint8_t     sd_state;
+    uint8_t     alarm;
+    uint8_t     wifi_state;
+    uint8_t     feed_override;
+    uint8_t     rapid_override;
+    uint8_t     spindle_override;
+    uint16_t    file_pct;                   // hundredths
+    int32_t     steps[G_NUM_AXIS];
+    int16_t     live_z;                     // microns
+    int16_t     mesh_z;                     // microns
+} gStatusFrame_t;
+
+
+
+class gStatus
+{
+public:
+
+    gStatus()   {}
+
+    void initWifiEventHandler();
+    void gWifiEvent(uint16_t event);
+
+    void updateStatus(bool inMeshLeveling=false, float meshZ=0, float liveZ=0);
+        // Called by client to update state of this object in a loop of some sort.
+        // If you are using the mesh, pass in "inLeveling" state in order to c
+        // correctly set the JobState, and the_mesh.getLastMeshZ() and getLiveZ()
+        // for the history and status frames.
+
+    // change notification
+
+    int subscribe(uint32_t mask, gStatusCallback callback=NULL, void *param=NULL);
+        // Returns an id, or -1 if there are too many subscribers.
+        // The callback is called from updateStatus(), in the task that calls it,
+        // with the changed bits in the mask. Without a callback, the changes are
+        // accumulated for takeChanges().
+    void unsubscribe(int id);
+    uint32_t takeChanges(int id);
+        // return and clear the changes accumulated for a subscriber
+        // without a callback.  May be called from any task.
+    void setPositionThreshold(float mm)  { m_position_threshold = mm; }
+        // how far any axis must move to count as a G_CHANGE_POSITION
+
+    JobState getJobState()          { return m_job_state; }
+    uint8_t getLastAlarm()          { return m_last_alarm; }
+        // alarm number is grabbed when job state changes so it can be displayed later
+
+    State getSysState()             { return m_sys_state; }
+    SDState getSDState(bool refresh=false);
+        // Never blocks.  refresh asks the SD task to check (and possibly
+        // mount) the card.  Its result is seen by the next updateStatus(),
+        // which reports a G_CHANGE_SD_STATE when the probe is done.
+
+    uint8_t getWifiState()          { return m_wifi_state; }
+    static uint8_t getWifiStationMode();
+    static const char *getWifiName();
+        // return name of current STATION or ACCESS_POINT when connected
+    static const char *getIPAddress();
+        // return current IP address when connected
+        // These are cached, and only refreshed by wifi events, so they
+        // do not allocate.  The strings are double buffered, and good until
+        // the second wifi event after the call, so copy them rather than keep them.
+
+    const char* getActiveFilename() { return m_active_filename; }
+    float filePct()                 { return m_file_pct; }
+    float timePct();
+        // percent of the estimated time of the SD job that has been run,
+        // from the GcodeScan of the file, or -1 until the scan is done
+    int32_t getETA();
+        // estimated seconds left in the SD job, or -1 if not known
+
+    void getSnapshot(gStatusSnapshot_t *snapshot);
+        // Copy the state published by the last updateStatus() without
+        // locking.  Safe from any task on either core, and never waits on
+        // updateStatus(), which writes the next of G_SNAPSHOTS copies.  The
+        // copy is only retried if that lapped it while it was being made.
+
+    // position history
+    // A ring of samples taken by updateStatus() at most every setHistoryRate() ms.
+
+    void setHistoryRate(uint32_t ms)    { m_history_ms = ms; }
+        // 0 turns off the history
+    int getHistory(gHistorySample_t *mins, gHistorySample_t *maxs, int buckets, int num_samples=G_HISTORY_SIZE);
+        // Downsample the most recent num_samples into upto "buckets" min/max pairs,
+        // oldest first, for plotting. The ms and job_state of each are from the
+        // last sample in the bucket. Returns the number of buckets filled.
+        // Lock-free, callable from any task; samples overwritten while
+        // being read are skipped.
+
+    // state transitions
+
+    int getTransitions(gTransition_t *transitions, int max);
+        // Copy upto max of the most recent job or sys state transitions,
+        // oldest first. Returns the number copied. Lock-free, from any task.
+    void getHistogram(gHistogram_t which, uint32_t *counts);
+        // copy the G_HISTOGRAM_BUCKETS counts of a histogram
+    void clearHistograms();
+
+    // binary status frames
+
+    void getFrame(gStatusFrame_t *frame);
+        // fill in a frame from a snapshot, from any task
+    static int encodeFrame(uint8_t *buf, int size, gStatusFrame_t *frame, const gStatusFrame_t *prev=NULL);
+        // Encode the frame into buf, as a delta from prev if it is given,
+        // setting the frame's sequence number. Returns the number of bytes,
+        // or 0 if size is less than G_FRAME_MAX.  Does not allocate.
+    static int decodeFrame(const uint8_t *buf, int len, gStatusFrame_t *frame);
+        // Decode a frame into frame, which must hold the previous frame
+        // for a delta. Returns the number of bytes used, or 0 if it is bad.
+
+    // per-job performance counters (see gCounters.h)
+
+    void getJobCounters(gJobCounters_t *counters)   { *counters = g_job_counters; }
+        // copy the counters, from any task
+    void resetJobCounters();
+        // done by updateStatus() when an SD job or mesh leveling starts
+
+    #if SD_READ_AHEAD
+        void getReadAhead(gReadAhead_t *stats)      { g_sd_read_ahead.getStats(stats); }
+    #else
+        void getReadAhead(gReadAhead_t *stats)      { *stats = gReadAhead_t(); }
+    #endif
+        // the occupancy and underruns of the SD read-ahead (see SDReadAhead.h)
+        // of the current, or last, SD job, from any task, all 0 if it is not built
+
+    // wrappers to FluidNC global variables
+
+    static float getFeedRate();
+    static float getAxisMaxTravel(int axis);
+    static float getAxisPulloff(int axis);
+    static float getAxisSeekRate(int axis);     // the faster of the two
+    static float getAxisFeedRate(int axis);
+    static volatile float getFeedOverride();
+    static float getRapidFeedOverride();
+    static float getSpindleOverride();
+    static bool  getProbeState();
+
+    // public denormalized FluidNC state variables
+    // only consistent in the task that calls updateStatus(),
+    // other tasks should use getSnapshot()
+
+    int32_t m_sys_pos[G_NUM_AXIS];
+    float m_machine_pos[G_NUM_AXIS];
+    float m_work_pos[G_NUM_AXIS];
+
+protected:
+
+    bool m_started = false;
+
+    // state variables
+
+    JobState  m_job_state = JOB_NONE;
+    State m_sys_state = State::Sleep;
+    SDState m_sdcard_state = SDState::NotPresent;
+
+    uint8_t m_last_alarm = 0;
+    uint8_t m_wifi_state = 0;
+
+    // network info, double buffered so that a refresh in the
+    // wifi event task does not overwrite the one being read.
+    // Refreshes are serialized by a mutex in gStatus.cpp.
+
+    typedef struct
+    {
+        uint8_t mode;           // 0 = none, 1=sta, 2=ap, 3=sta/ap
+        char name[33];
+        char ip_address[16];
+    } networkInfo_t;
+
+    static networkInfo_t s_network[2];
+    static volatile uint8_t s_network_index;
+
+    void refreshNetworkInfo();
+
+    const char *m_active_filename;
+    float m_file_pct;
+    float m_mesh_z = 0;
+    float m_live_z = 0;
+
+    // change notification
+
+    typedef struct
+    {
+        uint32_t mask;
+        gStatusCallback callback;
+        void *param;
+        volatile uint32_t pending;
+    } subscriber_t;
+
+    subscriber_t m_subscribers[G_MAX_SUBSCRIBERS] = {};
+    volatile uint32_t m_changes = 0;
+        // set from other tasks (i.e. gWifiEvent) for the next updateStatus()
+    float m_position_threshold = G_POSITION_THRESHOLD;
+    float m_notified_pos[2][G_NUM_AXIS] = {};
+        // machine and work positions last reported as changed
+    float m_notified_pct = 0;
+
+    // SD probing
+
+    volatile uint32_t m_sd_task_started = 0;
+    volatile uint32_t m_sd_probed = 0;
+        // set by the task, taken by updateStatus()
+
+    void startSDTask();
+    static void sdTask(void *param);
+
+    // job counter state
+
+    bool m_planner_busy = false;
+    bool m_probing = false;
+    bool m_stall_counted = false;
+    float m_empty_pct = 0;
+        // file percent when the planner drained
+
+    void countJob(JobState job_state, bool sd_started);
+
+    // published snapshots (a seqlock each)
+
+    gStatusSnapshot_t m_snapshot[G_SNAPSHOTS] = {};
+    volatile uint32_t m_snapshot_lock[G_SNAPSHOTS] = {};
+        // odd while that snapshot is being written
+    volatile uint32_t m_snapshot_idx = 0;
+        // the last one published
+
+    void publish();
+
+    // position history ring
+
+    gHistorySample_t m_history[G_HISTORY_SIZE];
+    volatile uint32_t m_history_count = 0;
+        // samples written
+    volatile uint32_t m_history_writing = 0;
+        // incremented before a sample is written
+    uint32_t m_history_ms = G_HISTORY_MS;
+    uint32_t m_history_last = 0;
+
+    void addHistory();
+
+    // state transition ring and histograms
+
+    gTransition_t m_transitions[G_TRANSITION_SIZE];
+    volatile uint32_t m_transition_count = 0;
+    volatile uint32_t m_transition_writing = 0;
+        // as for the history ring
+    volatile uint32_t m_histograms[G_NUM_HISTOGRAMS][G_HISTOGRAM_BUCKETS] = {};
+    bool m_polled = false;
+    uint32_t m_poll_ms = 0;
+        // millis() of the previous updateStatus()
+    uint32_t m_job_state_ms = 0;
+        // when m_job_state was entered
+
+    void addTransition(uint32_t now, uint32_t latency);
+    void addToHistogram(gHistogram_t which, uint32_t ms);
+
+    void addChanges(uint32_t changes)   { __atomic_fetch_or(&m_changes,changes,__ATOMIC_RELAXED); }
+    uint32_t positionChanges();
+    void notify(uint32_t changes);
+
+};  // class gStatus
+
+
+extern gStatus g_status;
+
+extern const char *sysStateName(State state);
+extern const char *sdStateName(SDState state);
+extern const char *jobStateName(JobState job_state);
@@ -0,0 +1,221 @@
+//-------------------------------------------------------
+// Binary status frames
+//-------------------------------------------------------
+// The encoder and decoder, apart from gStatus::getFrame(), which
+// need nothing from FluidNC, so that extras/frame_check can build
+// them on Linux.
+
+#include "gStatus.h"
+
+#include <string.h>
+
+
+static uint8_t *putInt(uint8_t *p, uint32_t value, int bytes)
+	// little endian
+{
+	for (int i=0; i<bytes; i++)
+	{
+		*p++ = value & 0xff;
+		value >>= 8;
+	}
+	return p;
+}
+
+static const uint8_t *getInt(const uint8_t *p, uint32_t *value, int bytes)
+{
+	*value = 0;
+	for (int i=0; i<bytes; i++)
+		*value |= ((uint32_t) *p++) << (8 * i);
+	return p;
+}
+
+static uint8_t *putDelta(uint8_t *p, int32_t delta)
+	// zigzag varint, upto 5 bytes
+{
+	uint32_t value = ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+	while (value >= 0x80)
+	{
+		*p++ = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	*p++ = value;
+	return p;
+}
+
+static const uint8_t *getDelta(const uint8_t *p, const uint8_t *end, int32_t *delta)
+	// returns NULL if the varint runs past the end
+{
+	uint32_t value = 0;
+	for (int shift=0; shift<35; shift+=7)
+	{
+		if (p >= end)
+			return NULL;
+		uint8_t c = *p++;
+		value |= (uint32_t) (c & 0x7f) << shift;
+		if (!(c & 0x80))
+		{
+			*delta = (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+			return p;
+		}
+	}
+	return NULL;
+}
+
+
+int gStatus::encodeFrame(uint8_t *buf, int size, gStatusFrame_t *frame, const gStatusFrame_t *prev /*=NULL*/)
+{
+	if (size < G_FRAME_MAX)
+		return 0;
+
+	uint16_t mask = G_FRAME_ALL;
+	frame->seq = prev ? prev->seq + 1 : 0;
+	if (prev)
+	{
+		mask = 0;
+		if (frame->ms != prev->ms)					mask |= G_FRAME_MS;
+		if (frame->job_state != prev->job_state)	mask |= G_FRAME_JOB_STATE;
+		if (frame->sys_state != prev->sys_state)	mask |= G_FRAME_SYS_STATE;
+		if (frame->sd_state != prev->sd_state)		mask |= G_FRAME_SD_STATE;
+		if (frame->alarm != prev->alarm)			mask |= G_FRAME_ALARM;
+		if (frame->wifi_state != prev->wifi_state)	mask |= G_FRAME_WIFI;
+		if (frame->file_pct != prev->file_pct)		mask |= G_FRAME_FILE_PCT;
+		if (frame->live_z != prev->live_z)			mask |= G_FRAME_LIVE_Z;
+		if (frame->mesh_z != prev->mesh_z)			mask |= G_FRAME_MESH_Z;
+		if (frame->feed_override != prev->feed_override ||
+			frame->rapid_override != prev->rapid_override ||
+			frame->spindle_override != prev->spindle_override)
+			mask |= G_FRAME_OVERRIDES;
+		if (memcmp(frame->steps,prev->steps,sizeof(frame->steps)))
+			mask |= G_FRAME_STEPS;
+	}
+
+	uint8_t *p = buf;
+	*p++ = G_FRAME_MAGIC;
+	*p++ = prev ? G_FRAME_DELTA : G_FRAME_FULL;
+	*p++ = frame->seq;
+	p = putInt(p,mask,2);
+
+	if (mask & G_FRAME_MS)
+		p = prev ? putDelta(p,frame->ms - prev->ms) : putInt(p,frame->ms,4);
+	if (mask & G_FRAME_JOB_STATE)	*p++ = frame->job_state;
+	if (mask & G_FRAME_SYS_STATE)	*p++ = frame->sys_state;
+	if (mask & G_FRAME_SD_STATE)	*p++ = frame->sd_state;
+	if (mask & G_FRAME_ALARM)		*p++ = frame->alarm;
+	if (mask & G_FRAME_WIFI)		*p++ = frame->wifi_state;
+	if (mask & G_FRAME_OVERRIDES)
+	{
+		*p++ = frame->feed_override;
+		*p++ = frame->rapid_override;
+		*p++ = frame->spindle_override;
+	}
+	if (mask & G_FRAME_FILE_PCT)
+		p = putInt(p,frame->file_pct,2);
+	if (mask & G_FRAME_STEPS)
+	{
+		// the differences wrap, as does the decoder adding them back
+
+		for (int i=0; i<G_NUM_AXIS; i++)
+			p = prev ? putDelta(p,(uint32_t) frame->steps[i] - (uint32_t) prev->steps[i]) : putInt(p,frame->steps[i],4);
+	}
+	if (mask & G_FRAME_LIVE_Z)
+		p = putInt(p,(uint16_t) frame->live_z,2);
+	if (mask & G_FRAME_MESH_Z)
+		p = prev ? putDelta(p,frame->mesh_z - prev->mesh_z) : putInt(p,(uint16_t) frame->mesh_z,2);
+
+	return p - buf;
+}
+
+
+int gStatus::decodeFrame(const uint8_t *buf, int len, gStatusFrame_t *frame)
+{
+	const uint8_t *p = buf;
+	const uint8_t *end = buf + len;
+	if (len < G_FRAME_HEADER ||
+		p[0] != G_FRAME_MAGIC ||
+		(p[1] != G_FRAME_FULL && p[1] != G_FRAME_DELTA))
+		return 0;
+
+	bool delta = p[1] == G_FRAME_DELTA;
+	uint32_t value;
+	int32_t diff;
+	frame->seq = p[2];
+	p = getInt(p+3,&value,2);
+	uint16_t mask = value;
+
+	// the size of the fixed size fields in a full frame
+
+	int need = 0;
+	if (!delta)
+	{
+		if (mask != G_FRAME_ALL)
+			return 0;
+		need = G_FRAME_FULL_SIZE - G_FRAME_HEADER;
+	}
+	if (end - p < need)
+		return 0;
+
+	#define FRAME_BYTE(bit,field) \
+		if (mask & bit) { if (p >= end) return 0; frame->field = *p++; }
+
+	if (mask & G_FRAME_MS)
+	{
+		if (!delta)
+			p = getInt(p,&frame->ms,4);
+		else if (!(p = getDelta(p,end,&diff)))
+			return 0;
+		else
+			frame->ms += diff;
+	}
+	FRAME_BYTE(G_FRAME_JOB_STATE,job_state)
+	FRAME_BYTE(G_FRAME_SYS_STATE,sys_state)
+	FRAME_BYTE(G_FRAME_SD_STATE,sd_state)
+	FRAME_BYTE(G_FRAME_ALARM,alarm)
+	FRAME_BYTE(G_FRAME_WIFI,wifi_state)
+	FRAME_BYTE(G_FRAME_OVERRIDES,feed_override)
+	FRAME_BYTE(G_FRAME_OVERRIDES,rapid_override)
+	FRAME_BYTE(G_FRAME_OVERRIDES,spindle_override)
+	if (mask & G_FRAME_FILE_PCT)
+	{
+		if (end - p < 2)
+			return 0;
+		p = getInt(p,&value,2);
+		frame->file_pct = value;
+	}
+	if (mask & G_FRAME_STEPS)
+	{
+		for (int i=0; i<G_NUM_AXIS; i++)
+		{
+			if (!delta)
+			{
+				p = getInt(p,&value,4);
+				frame->steps[i] = value;
+			}
+			else if (!(p = getDelta(p,end,&diff)))
+				return 0;
+			else
+				frame->steps[i] = (uint32_t) frame->steps[i] + (uint32_t) diff;
+		}
+	}
+	if (mask & G_FRAME_LIVE_Z)
+	{
+		if (end - p < 2)
+			return 0;
+		p = getInt(p,&value,2);
+		frame->live_z = (int16_t) value;
+	}
+	if (mask & G_FRAME_MESH_Z)
+	{
+		if (!delta)
+		{
+			p = getInt(p,&value,2);
+			frame->mesh_z = (int16_t) value;
+		}
+		else if (!(p = getDelta(p,end,&diff)))
+			return 0;
+		else
+			frame->mesh_z += diff;
+	}
+	#undef FRAME_BYTE
+
+	return p - buf;
+}